@@ -0,0 +1,74 @@
+#include "arena.h"
+#include "utils.h"
+
+thread_local Arena* Arena::current;
+
+Arena::Arena() : count(), bytes()
+{
+    ICE_IF(current, "Only one arena at a time");
+    current = this;
+}
+
+Arena::Arena(Arena* parent) : count(), bytes()
+{
+    ICE_IF(!parent, "Worker arena without a parent");
+}
+
+Arena::~Arena()
+{
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+    {
+	it->second(it->first);
+    }
+    if (current == this)
+    {
+	current = 0;
+    }
+}
+
+void* Arena::Allocate(size_t size, NodeKind kind, Destroyer destroy)
+{
+    ICE_IF(!current, "Node allocated outside of a compilation");
+    current->count[kind]++;
+    current->bytes[kind] += size;
+    void* p = current->allocator.Allocate(size, llvm::Align(alignof(std::max_align_t)));
+    current->nodes.emplace_back(p, destroy);
+    return p;
+}
+
+Arena::ThreadScope::ThreadScope(Arena* p) : parent(p), saved(current), arena(new Arena(p))
+{
+    current = arena;
+}
+
+Arena::ThreadScope::~ThreadScope()
+{
+    current = saved;
+    std::lock_guard<std::mutex> lock(parent->childMutex);
+    parent->children.emplace_back(arena);
+}
+
+void Arena::AddStats(size_t cnt[NumKinds], size_t sz[NumKinds], size_t& reserved) const
+{
+    for (int k = 0; k < NumKinds; k++)
+    {
+	cnt[k] += count[k];
+	sz[k] += bytes[k];
+    }
+    reserved += allocator.getTotalMemory();
+    for (auto& c : children)
+    {
+	c->AddStats(cnt, sz, reserved);
+    }
+}
+
+void Arena::PrintStats(std::ostream& out) const
+{
+    size_t cnt[NumKinds] = {};
+    size_t sz[NumKinds] = {};
+    size_t reserved = 0;
+    AddStats(cnt, sz, reserved);
+    out << "Arena: " << cnt[AST] << " AST nodes (" << sz[AST] / 1024 << " KB), " << cnt[Type]
+        << " type nodes (" << sz[Type] / 1024 << " KB), " << reserved / 1024 << " KB reserved"
+        << std::endl;
+}
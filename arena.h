@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <iostream>
+#include <llvm/Support/Allocator.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Bump allocator for the AST and type nodes of one compilation. Nodes are never deleted one by
+// one: the whole arena is given back when it is destroyed, after code generation. The destructor
+// of each node is run then, so that what it owns outside the arena (such as the buffer of a long
+// std::string) is freed too.
+class Arena
+{
+public:
+    enum NodeKind
+    {
+	AST,
+	Type,
+	NumKinds
+    };
+
+    Arena();
+    ~Arena();
+    using Destroyer = void (*)(void*);
+    static void*  Allocate(size_t size, NodeKind kind, Destroyer destroy);
+    static Arena* Current() { return current; }
+    void          PrintStats(std::ostream& out) const;
+    // Node types have virtual destructors, so this destroys whatever class was allocated.
+    template<typename T>
+    static void Destroy(void* p)
+    {
+	static_cast<T*>(p)->~T();
+    }
+
+    // Units used by the program are parsed on several threads at once. Each of them allocates
+    // from an arena of its own, without locking, which is handed to the arena of the thread that
+    // started it when it is done.
+    class ThreadScope
+    {
+    public:
+	ThreadScope(Arena* parent);
+	~ThreadScope();
+
+    private:
+	Arena* parent;
+	Arena* saved;
+	Arena* arena;
+    };
+
+private:
+    Arena(Arena* parent);
+    void AddStats(size_t cnt[NumKinds], size_t sz[NumKinds], size_t& reserved) const;
+
+    llvm::BumpPtrAllocator                   allocator;
+    size_t                                   count[NumKinds];
+    size_t                                   bytes[NumKinds];
+    std::vector<std::pair<void*, Destroyer>> nodes;
+    std::mutex                               childMutex;
+    std::vector<std::unique_ptr<Arena>>      children;
+    static thread_local Arena*               current;
+};
+
+#endif
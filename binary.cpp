@@ -1,4 +1,5 @@
 #include "binary.h"
+#include "cache.h"
 #include "expr.h"
 #include "options.h"
 #include "trace.h"
@@ -6,16 +7,35 @@
 #pragma clang diagnostic ignored "-Wunused-function"
 #include <llvm/CodeGen/CommandFlags.h>
 #pragma clang diagnostic pop
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#if LLD_ENABLE
+#include <lld/Common/Driver.h>
+#endif
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/MC/TargetRegistry.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/CodeGen.h>
+#include <llvm/Support/Error.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/FormattedStream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Target/TargetMachine.h>
@@ -23,14 +43,49 @@
 #include <llvm/TargetParser/SubtargetFeature.h>
 #include <llvm/TargetParser/TargetParser.h>
 #include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <set>
 #include <system_error>
+#include <thread>
 
 static llvm::codegen::RegisterCodeGenFlags CGF;
 
+static std::unique_ptr<llvm::TargetMachine> targetMachine;
+// Objects of separately compiled units.
+static std::vector<std::string> linkObjects;
+
+void AddLinkObject(const std::string& objName)
+{
+    if (std::find(linkObjects.begin(), linkObjects.end(), objName) == linkObjects.end())
+    {
+	linkObjects.push_back(objName);
+    }
+}
+
+static std::string GetCPU()
+{
+    std::string mcpu = llvm::codegen::getMCPU();
+    if (mcpu == "native")
+    {
+	mcpu = llvm::sys::getHostCPUName().str();
+    }
+    return mcpu;
+}
+
 std::string GetFeatureString()
 {
+    llvm::SubtargetFeatures Features;
+    // For "native", use what the host actually supports, as some CPU models come with
+    // features (e.g. AVX-512) disabled.
+    if (llvm::codegen::getMCPU() == "native")
+    {
+	for (auto& f : llvm::sys::getHostCPUFeatures())
+	{
+	    Features.AddFeature(f.first(), f.second);
+	}
+    }
     std::vector<std::string> mattrs = llvm::codegen::getMAttrs();
-    llvm::SubtargetFeatures  Features;
     for (auto m : mattrs)
     {
 	Features.AddFeature(m);
@@ -38,6 +93,27 @@ std::string GetFeatureString()
     return Features.getString();
 }
 
+static llvm::CodeGenOptLevel GetCodeGenOptLevel()
+{
+    switch (optimization)
+    {
+    case O0:
+	return llvm::CodeGenOptLevel::None;
+    case O1:
+	return llvm::CodeGenOptLevel::Less;
+    case O2:
+	return llvm::CodeGenOptLevel::Default;
+    case O3:
+	return llvm::CodeGenOptLevel::Aggressive;
+    }
+    ICE("Unknown optimisation level");
+}
+
+llvm::TargetMachine* GetTargetMachine()
+{
+    return targetMachine.get();
+}
+
 static llvm::ToolOutputFile* GetOutputStream(const std::string& filename)
 {
     // Open the file.
@@ -54,40 +130,9 @@ static llvm::ToolOutputFile* GetOutputStream(const std::string& filename)
     return FDOut;
 }
 
-static void CreateObject(llvm::Module* module, const std::string& objname)
+static bool EmitObject(llvm::Module& module, llvm::TargetMachine* tm, const std::string& objname)
 {
-    TIME_TRACE();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmPrinters();
-    llvm::InitializeAllAsmParsers();
-
-    std::string         error;
-    llvm::Triple        triple = llvm::Triple(module->getTargetTriple());
-    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
-
-    if (!target)
-    {
-	std::cerr << "Error, could not find target: " << error << std::endl;
-	return;
-    }
-
-    std::string mcpu = llvm::codegen::getMCPU();
-    if (mcpu == "native")
-    {
-	mcpu = llvm::sys::getHostCPUName().str();
-    }
-
-    llvm::TargetOptions                  options;
-    std::string                          FeaturesStr = GetFeatureString();
-    std::unique_ptr<llvm::TargetMachine> tm(
-        target->createTargetMachine(triple, mcpu, FeaturesStr, options, llvm::Reloc::PIC_));
-
-    if (!tm)
-    {
-	std::cerr << "Error: Could not create targetmachine." << std::endl;
-	return;
-    }
+    llvm::Triple triple = tm->getTargetTriple();
 
     llvm::legacy::PassManager           PM;
     llvm::TargetLibraryInfoWrapperPass* TLI = new llvm::TargetLibraryInfoWrapperPass(triple);
@@ -97,7 +142,7 @@ static void CreateObject(llvm::Module* module, const std::string& objname)
     if (!Out)
     {
 	std::cerr << "Could not open file ... " << std::endl;
-	return;
+	return false;
     }
 
     llvm::raw_pwrite_stream* OS = &Out->os();
@@ -107,10 +152,92 @@ static void CreateObject(llvm::Module* module, const std::string& objname)
 	std::cerr << objname
 	          << ": target does not support generation of this"
 	             " file type!\n";
-	return;
+	return false;
     }
-    PM.run(*module);
+    PM.run(module);
     Out->keep();
+    return true;
+}
+
+static bool CreateObject(llvm::Module* module, const std::string& objname)
+{
+    TIME_TRACE();
+    return EmitObject(*module, GetTargetMachine(), objname);
+}
+
+// With -j, the module is split into this many partitions, based on the number of functions only,
+// so that the objects are the same for any number of threads. The limits don't change that, as
+// they too only depend on the module: a program with fewer than 16 functions is a single
+// partition, and one with 256 or more is split in 32. ParallelTestCase compares -j 1 and -j 4.
+static size_t NumPartitions(const llvm::Module& module)
+{
+    const size_t functionsPerPartition = 8;
+    const size_t maxPartitions = 32;
+
+    size_t functions = 0;
+    for (auto& f : module)
+    {
+	if (!f.isDeclaration())
+	{
+	    functions++;
+	}
+    }
+    return std::clamp<size_t>(functions / functionsPerPartition, 1, maxPartitions);
+}
+
+// Code generate the partitions on codegenThreads threads. Each partition is passed as bitcode to a
+// thread, which reads it into its own LLVMContext and uses its own TargetMachine.
+static bool CreateObjectsParallel(llvm::Module* module, const std::vector<std::string>& objnames)
+{
+    TIME_TRACE();
+    std::vector<llvm::SmallString<0>> partitions;
+    auto                              addPartition = [&partitions](std::unique_ptr<llvm::Module> part)
+    {
+	partitions.emplace_back();
+	llvm::raw_svector_ostream os(partitions.back());
+	llvm::WriteBitcodeToFile(*part, os);
+    };
+    llvm::SplitModule(*module, objnames.size(), addPartition);
+
+    llvm::TargetMachine* mainTm = GetTargetMachine();
+    std::atomic<size_t>  next(0);
+    std::atomic<bool>    ok(true);
+    auto                 worker = [&]()
+    {
+	for (size_t i = next++; i < partitions.size(); i = next++)
+	{
+	    // The name becomes the module identifier, so don't use the (temporary) object name.
+	    std::string                                   name = "partition" + std::to_string(i);
+	    llvm::LLVMContext                             context;
+	    llvm::MemoryBufferRef                         buffer(partitions[i].str(), name);
+	    llvm::Expected<std::unique_ptr<llvm::Module>> part = llvm::parseBitcodeFile(buffer, context);
+	    if (!part)
+	    {
+		llvm::logAllUnhandledErrors(part.takeError(), llvm::errs(), "Partition: ");
+		ok = false;
+		continue;
+	    }
+	    std::unique_ptr<llvm::TargetMachine> tm(mainTm->getTarget().createTargetMachine(
+	        mainTm->getTargetTriple(), mainTm->getTargetCPU(), mainTm->getTargetFeatureString(),
+	        mainTm->Options, mainTm->getRelocationModel(), mainTm->getCodeModel(),
+	        mainTm->getOptLevel()));
+	    if (!tm || !EmitObject(**part, tm.get(), objnames[i]))
+	    {
+		ok = false;
+	    }
+	}
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < std::min<size_t>(codegenThreads, partitions.size()); t++)
+    {
+	threads.emplace_back(worker);
+    }
+    for (auto& t : threads)
+    {
+	t.join();
+    }
+    return ok;
 }
 
 std::string replace_ext(const std::string& origName, const std::string& expectedExt,
@@ -124,50 +251,284 @@ std::string replace_ext(const std::string& origName, const std::string& expected
     return origName.substr(0, origName.size() - expectedExt.size()) + newExt;
 }
 
-bool CreateBinary(llvm::Module* module, const std::string& filename, EmitType emit)
+static bool LinkExternal(const std::vector<std::string>& objnames, const std::string& exename)
 {
     TIME_TRACE();
-    if (emit == Exe)
-    {
-	std::string objname = replace_ext(filename, ".pas", ".o");
-	std::string exename = replace_ext(filename, ".pas", "");
-	std::string modelStr;
+    std::string modelStr;
 
 // Order matters here: clang, being gcc-compatible, will have __GNUC__ defined.
 #ifdef __clang__
-	std::string compiler = "clang";
+    std::string compiler = "clang";
 #elif defined(__GNUC__)
-	std::string compiler = "gcc";
+    std::string compiler = "gcc";
 #endif
-	if (model == m32)
+    if (model == m32)
+    {
+	modelStr = "-m32";
+    }
+
+    std::string verboseflags;
+    if (verbosity)
+    {
+	verboseflags = " -v";
+    }
+    std::string debugFlag;
+    if (debugInfo)
+    {
+	debugFlag = " -g";
+    }
+    std::string objects;
+    for (auto o : objnames)
+    {
+	objects += " \"" + o + "\"";
+    }
+    for (auto o : linkObjects)
+    {
+	objects += " \"" + o + "\"";
+    }
+    // The profile runtime is only pulled in from the archive when asked for.
+    std::string profileFlag;
+    if (profileGenerate)
+    {
+	profileFlag = " -Wl,-u,__llvm_profile_runtime";
+    }
+    std::string cmd = compiler + " " + modelStr + verboseflags + profileFlag + objects + " -L\"" + libpath +
+                      "\" -lruntime" + modelStr + debugFlag + " -lm -o " + exename;
+    if (verbosity)
+    {
+	std::cerr << "Executing final link command: " << cmd << std::endl;
+    }
+    int res = system(cmd.c_str());
+    if (res != 0)
+    {
+	std::cerr << "Error: " << res << std::endl;
+	return false;
+    }
+    return true;
+}
+
+#if LLD_ENABLE
+LLD_HAS_DRIVER(elf)
+
+static std::string FindFile(const std::vector<std::string>& dirs, const std::string& name)
+{
+    for (auto d : dirs)
+    {
+	std::string path = d + "/" + name;
+	if (llvm::sys::fs::exists(path))
+	{
+	    return path;
+	}
+    }
+    return "";
+}
+
+// Find the newest gcc installation directory that has crtbeginS.o (and libgcc) for this model.
+static std::string FindGccDir()
+{
+    std::string best;
+    int         bestVersion = -1;
+    for (auto root : { "/usr/lib/gcc", "/usr/lib64/gcc" })
+    {
+	std::error_code ec;
+	for (llvm::sys::fs::directory_iterator t(root, ec), e; t != e && !ec; t.increment(ec))
 	{
-	    modelStr = "-m32";
+	    for (llvm::sys::fs::directory_iterator v(t->path(), ec), ve; v != ve && !ec; v.increment(ec))
+	    {
+		std::string dir = v->path();
+		if (model == m32)
+		{
+		    dir += "/32";
+		}
+		int version = std::atoi(llvm::sys::path::filename(v->path()).str().c_str());
+		if (version > bestVersion && llvm::sys::fs::exists(dir + "/crtbeginS.o"))
+		{
+		    best = dir;
+		    bestVersion = version;
+		}
+	    }
+	    ec.clear();
 	}
+    }
+    return best;
+}
+
+// Link using LLD within the compiler. Returns false if the C library or gcc support files
+// can't be found, in which case the caller should use the external link command.
+static bool LinkInProcess(const llvm::Triple& triple, const std::vector<std::string>& objnames,
+                          const std::string& exename, bool& linked)
+{
+    TIME_TRACE();
+    linked = false;
+
+    std::string emulation;
+    std::string dynLinker;
+    switch (triple.getArch())
+    {
+    case llvm::Triple::x86_64:
+	emulation = "elf_x86_64";
+	dynLinker = "/lib64/ld-linux-x86-64.so.2";
+	break;
+    case llvm::Triple::x86:
+	emulation = "elf_i386";
+	dynLinker = "/lib/ld-linux.so.2";
+	break;
+    case llvm::Triple::aarch64:
+	emulation = "aarch64linux";
+	dynLinker = "/lib/ld-linux-aarch64.so.1";
+	break;
+    default:
+	return false;
+    }
+
+    std::string              multiarch = llvm::Triple::getArchTypeName(triple.getArch()).str() + "-linux-gnu";
+    std::vector<std::string> libDirs = { "/usr/lib/" + multiarch, "/lib/" + multiarch };
+    if (model == m32)
+    {
+	libDirs.insert(libDirs.end(), { "/usr/lib32", "/lib32" });
+    }
+    else
+    {
+	libDirs.insert(libDirs.end(), { "/usr/lib64", "/lib64" });
+    }
+    libDirs.insert(libDirs.end(), { "/usr/lib", "/lib" });
 
-	CreateObject(module, objname);
-	std::string verboseflags;
+    std::string gccDir = FindGccDir();
+    std::string crt1 = FindFile(libDirs, "Scrt1.o");
+    std::string crti = FindFile(libDirs, "crti.o");
+    std::string crtn = FindFile(libDirs, "crtn.o");
+    if (gccDir.empty() || crt1.empty() || crti.empty() || crtn.empty())
+    {
 	if (verbosity)
 	{
-	    verboseflags = " -v";
+	    std::cerr << "Could not find C library start files, using external linker" << std::endl;
 	}
-	std::string debugFlag;
-	if (debugInfo)
+	return false;
+    }
+
+    std::string              runtimeLib = model == m32 ? "-lruntime-m32" : "-lruntime";
+    std::vector<std::string> args = { "ld.lld", "-m", emulation, "-pie", "--eh-frame-hdr", "-dynamic-linker",
+	                              dynLinker, "-o", exename, crt1, crti, gccDir + "/crtbeginS.o",
+	                              "-L" + libpath, "-L" + gccDir };
+    args.insert(args.end(), objnames.begin(), objnames.end());
+    args.insert(args.end(), linkObjects.begin(), linkObjects.end());
+    if (profileGenerate)
+    {
+	args.insert(args.end(), { "-u", "__llvm_profile_runtime" });
+    }
+    for (auto d : libDirs)
+    {
+	args.push_back("-L" + d);
+    }
+    args.insert(args.end(), { runtimeLib, "-lm", "-lgcc", "--as-needed", "-lgcc_s", "--no-as-needed", "-lc",
+	                      "-lgcc", gccDir + "/crtendS.o", crtn });
+    if (verbosity)
+    {
+	args.push_back("--verbose");
+    }
+
+    std::vector<const char*> argv;
+    for (auto& a : args)
+    {
+	argv.push_back(a.c_str());
+    }
+    if (verbosity)
+    {
+	std::cerr << "Linking in-process:";
+	for (auto a : argv)
 	{
-	    debugFlag = " -g";
+	    std::cerr << " " << a;
 	}
-	std::string cmd = compiler + " " + modelStr + verboseflags + " " + objname + " -L\"" + libpath +
-	                  "\" -lruntime" + modelStr + debugFlag + " -lm -o " + exename;
-	if (verbosity)
+	std::cerr << std::endl;
+    }
+
+    lld::Result res = lld::lldMain(argv, llvm::outs(), llvm::errs(), { { lld::Gnu, &lld::elf::link } });
+    linked = res.retCode == 0;
+    return true;
+}
+#endif
+
+static bool Link(const std::vector<std::string>& objnames, const std::string& exename)
+{
+    bool linked = false;
+    bool done = false;
+#if LLD_ENABLE
+    if (lldLink)
+    {
+	done = LinkInProcess(GetTargetMachine()->getTargetTriple(), objnames, exename, linked);
+    }
+#endif
+    if (!done)
+    {
+	linked = LinkExternal(objnames, exename);
+    }
+    return linked;
+}
+
+// Name of the n'th object of the program, for -keep-obj.
+static std::string KeptObjectName(const std::string& filename, size_t n)
+{
+    return replace_ext(filename, ".pas", n ? "." + std::to_string(n) + ".o" : ".o");
+}
+
+bool LinkObjects(const std::vector<std::string>& objnames, const std::string& filename)
+{
+    TIME_TRACE();
+    if (keepObject)
+    {
+	for (size_t i = 0; i < objnames.size(); i++)
+	{
+	    llvm::sys::fs::copy_file(objnames[i], KeptObjectName(filename, i));
+	}
+    }
+    return Link(objnames, replace_ext(filename, ".pas", ""));
+}
+
+bool CreateBinary(llvm::Module* module, const std::string& filename, EmitType emit)
+{
+    TIME_TRACE();
+    if (emit == Exe)
+    {
+	std::string exename = replace_ext(filename, ".pas", "");
+	// A unit is not linked, the object is used when linking the program.
+	if (compileUnit)
 	{
-	    std::cerr << "Executing final link command: " << cmd << std::endl;
+	    return CreateObject(module, replace_ext(filename, ".pas", ".o"));
 	}
-	int res = system(cmd.c_str());
-	if (res != 0)
+
+	size_t                   parts = codegenThreads ? NumPartitions(*module) : 1;
+	std::vector<std::string> objnames;
+	for (size_t i = 0; i < parts; i++)
 	{
-	    std::cerr << "Error: " << res << std::endl;
-	    return false;
+	    if (keepObject)
+	    {
+		objnames.push_back(KeptObjectName(filename, i));
+		continue;
+	    }
+	    llvm::SmallString<128> tmpName;
+	    if (std::error_code ec = llvm::sys::fs::createTemporaryFile("lacsap", "o", tmpName))
+	    {
+		std::cerr << "Could not create temporary file: " << ec.message() << std::endl;
+		return false;
+	    }
+	    objnames.push_back(tmpName.str().str());
 	}
-	return true;
+
+	bool linked =
+	    parts == 1 ? CreateObject(module, objnames[0]) : CreateObjectsParallel(module, objnames);
+	if (linked)
+	{
+	    CacheStore(objnames, linkObjects);
+	    linked = Link(objnames, exename);
+	}
+	if (!keepObject)
+	{
+	    for (auto o : objnames)
+	    {
+		llvm::sys::fs::remove(o);
+	    }
+	}
+	return linked;
     }
     ICE_IF(emit != LlvmIr, "Expect LLVM IR here..");
 
@@ -179,9 +540,193 @@ bool CreateBinary(llvm::Module* module, const std::string& filename, EmitType em
     return true;
 }
 
+bool CreateInterface(UnitAST* unit, const std::string& filename)
+{
+    TIME_TRACE();
+    std::string   ifaceName = replace_ext(filename, ".pas", ".pi");
+    std::ofstream out(ifaceName);
+    if (!out)
+    {
+	std::cerr << "Could not open " << ifaceName << std::endl;
+	return false;
+    }
+    // Header lines are read back by the parser when the unit is used.
+    for (auto i : unit->InitNames())
+    {
+	out << "{ #init " << i << " }\n";
+    }
+    for (auto o : linkObjects)
+    {
+	out << "{ #object " << o << " }\n";
+    }
+    out << unit->InterfaceText();
+    return true;
+}
+
+static int JitError(llvm::Error err)
+{
+    llvm::logAllUnhandledErrors(std::move(err), llvm::errs(), "Error: ");
+    return 1;
+}
+
+bool LinkRuntimeBitcode(llvm::Module* module)
+{
+    TIME_TRACE();
+    if (model == m32)
+    {
+	std::cerr << "The runtime bitcode is only available for the 64-bit model" << std::endl;
+	return false;
+    }
+    std::string                   bcName = libpath + "/libruntime.bc";
+    llvm::SMDiagnostic            err;
+    std::unique_ptr<llvm::Module> runtime = llvm::parseIRFile(bcName, err, module->getContext());
+    if (!runtime)
+    {
+	err.print("lacsap", llvm::errs());
+	return false;
+    }
+    llvm::Triple triple = GetTargetMachine()->getTargetTriple();
+    if (llvm::Triple(runtime->getTargetTriple()).getArch() != triple.getArch())
+    {
+	std::cerr << bcName << " is not built for " << triple.str() << std::endl;
+	return false;
+    }
+    runtime->setTargetTriple(module->getTargetTriple());
+    runtime->setDataLayout(module->getDataLayout());
+
+    // Objects of separately compiled units use the runtime and the program's interface, so those
+    // have to stay visible. Otherwise only main is needed.
+    std::set<std::string> keep = { "main" };
+    if (!linkObjects.empty())
+    {
+	for (auto m : { runtime.get(), module })
+	{
+	    for (auto& gv : m->global_values())
+	    {
+		if (!gv.isDeclaration() && !gv.hasLocalLinkage())
+		{
+		    keep.insert(gv.getName().str());
+		}
+	    }
+	}
+    }
+    if (llvm::Linker::linkModules(*module, std::move(runtime)))
+    {
+	std::cerr << "Failed to link " << bcName << std::endl;
+	return false;
+    }
+    llvm::internalizeModule(*module,
+                            [&keep](const llvm::GlobalValue& gv) { return keep.count(gv.getName().str()); });
+    return true;
+}
+
+int RunModule(llvm::Module* module, const std::string& filename, const std::vector<std::string>& args,
+              std::chrono::steady_clock::time_point start)
+{
+    TIME_TRACE();
+    if (model == m32)
+    {
+	std::cerr << "Error: --run is only supported for the 64-bit model" << std::endl;
+	return 1;
+    }
+
+    // The JIT owns its TargetMachine, so make it the same as the one used for optimisation.
+    llvm::TargetMachine*               tm = GetTargetMachine();
+    llvm::orc::JITTargetMachineBuilder jtmb(tm->getTargetTriple());
+    jtmb.setCPU(tm->getTargetCPU().str());
+    jtmb.getFeatures() = llvm::SubtargetFeatures(tm->getTargetFeatureString());
+    jtmb.setCodeGenOptLevel(GetCodeGenOptLevel());
+
+    auto jit = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(jtmb)).create();
+    if (!jit)
+    {
+	return JitError(jit.takeError());
+    }
+
+    // Runtime functions come from the same libruntime.a that an executable is linked with,
+    // anything else (libc, libm) is found in the compiler process itself.
+    llvm::orc::JITDylib& jd = (*jit)->getMainJITDylib();
+    std::string          runtimeLib = libpath + "/libruntime.a";
+    auto                 rtGen =
+        llvm::orc::StaticLibraryDefinitionGenerator::Load((*jit)->getObjLinkingLayer(), runtimeLib.c_str());
+    if (!rtGen)
+    {
+	return JitError(rtGen.takeError());
+    }
+    jd.addGenerator(std::move(*rtGen));
+
+    char prefix = (*jit)->getDataLayout().getGlobalPrefix();
+    auto procGen = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix);
+    if (!procGen)
+    {
+	return JitError(procGen.takeError());
+    }
+    jd.addGenerator(std::move(*procGen));
+
+    // The module belongs to the global theContext, which can't be handed over to the JIT. As for
+    // parallel code generation, it is passed as bitcode into a context that the JIT owns.
+    llvm::SmallString<0> bitcode;
+    {
+	llvm::raw_svector_ostream os(bitcode);
+	llvm::WriteBitcodeToFile(*module, os);
+    }
+    delete module;
+    auto                                          context = std::make_unique<llvm::LLVMContext>();
+    llvm::MemoryBufferRef                         buffer(bitcode.str(), filename);
+    llvm::Expected<std::unique_ptr<llvm::Module>> jitModule = llvm::parseBitcodeFile(buffer, *context);
+    if (!jitModule)
+    {
+	return JitError(jitModule.takeError());
+    }
+    llvm::orc::ThreadSafeModule tsm(std::move(*jitModule), std::move(context));
+    if (auto err = (*jit)->addIRModule(std::move(tsm)))
+    {
+	return JitError(std::move(err));
+    }
+    for (auto o : linkObjects)
+    {
+	auto buffer = llvm::MemoryBuffer::getFile(o);
+	if (!buffer)
+	{
+	    std::cerr << "Error: Could not read " << o << ": " << buffer.getError().message() << std::endl;
+	    return 1;
+	}
+	if (auto err = (*jit)->addObjectFile(std::move(*buffer)))
+	{
+	    return JitError(std::move(err));
+	}
+    }
+
+    // Use main from the runtime, so that files and units are initialised as in an executable.
+    auto mainSym = (*jit)->lookup("main");
+    if (!mainSym)
+    {
+	return JitError(mainSym.takeError());
+    }
+    auto mainFunc = mainSym->toPtr<int(int, char**)>();
+
+    if (timetrace)
+    {
+	auto     end = std::chrono::steady_clock::now();
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cerr << "Time to first instruction " << std::fixed << std::setprecision(3) << elapsed / 1000.0
+	          << " ms" << std::endl;
+    }
+    // Name the program as it would be when running the executable from the current directory.
+    std::string progName = replace_ext(filename, ".pas", "");
+    if (progName[0] != '/')
+    {
+	progName = "./" + progName;
+    }
+    return llvm::orc::runAsMain(mainFunc, args, progName);
+}
+
 llvm::Module* CreateModule()
 {
-    llvm::InitializeNativeTarget();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmPrinters();
+    llvm::InitializeAllAsmParsers();
 
     llvm::Module* module = new llvm::Module("TheModule", theContext);
 
@@ -203,13 +748,12 @@ llvm::Module* CreateModule()
 	return 0;
     }
 
-    std::string                          FeaturesStr = GetFeatureString();
-    llvm::TargetOptions                  options;
-    std::string                          mcpu = llvm::codegen::getMCPU();
-    std::unique_ptr<llvm::TargetMachine> tm(
-        target->createTargetMachine(triple, mcpu, FeaturesStr, options, llvm::Reloc::Static));
-    ICE_IF(!tm, "Could not create TargetMachine");
-    const llvm::DataLayout dl = tm->createDataLayout();
+    // This TargetMachine is used for optimisation, object file generation and JIT.
+    llvm::TargetOptions options;
+    targetMachine.reset(target->createTargetMachine(triple, GetCPU(), GetFeatureString(), options,
+                                                    llvm::Reloc::PIC_, std::nullopt, GetCodeGenOptLevel()));
+    ICE_IF(!targetMachine, "Could not create TargetMachine");
+    const llvm::DataLayout dl = targetMachine->createDataLayout();
     module->setDataLayout(dl);
     return module;
 }
@@ -1,15 +1,39 @@
 #ifndef BINARY_H
 #define BINARY_H
 #include "options.h"
+#include <chrono>
 #include <string>
+#include <vector>
+
+class UnitAST;
 
 namespace llvm
 {
     class Module;
+    class TargetMachine;
 }
 
 bool CreateBinary(llvm::Module* module, const std::string& fileName, EmitType emit);
 
+// Link existing object files (e.g. from the cache) into the executable for fileName.
+bool LinkObjects(const std::vector<std::string>& objNames, const std::string& fileName);
+
+// JIT compile the module and run it in-process, returns the exit code of the program.
+int RunModule(llvm::Module* module, const std::string& fileName, const std::vector<std::string>& args,
+              std::chrono::steady_clock::time_point start);
+
 llvm::Module* CreateModule();
 
+// Link libruntime.bc into the module, so that the runtime is optimised along with the program.
+bool LinkRuntimeBitcode(llvm::Module* module);
+
+// Write the interface file for a unit compiled with -unit.
+bool CreateInterface(UnitAST* unit, const std::string& fileName);
+
+// Add the object file of a separately compiled unit to the final link.
+void AddLinkObject(const std::string& objName);
+
+// The TargetMachine created by CreateModule, used for all code generation of the module.
+llvm::TargetMachine* GetTargetMachine();
+
 #endif
@@ -1,6 +1,7 @@
 #include "builtin.h"
 #include "expr.h"
 #include "options.h"
+#include <climits>
 #include <functional>
 #include <llvm/IR/DataLayout.h>
 
@@ -391,8 +392,9 @@ namespace Builtin
     {
     public:
 	using FunctionString::FunctionString;
-	llvm::Value* CodeGen(llvm::IRBuilder<>& builder) override;
-	ErrorType    Semantics() override;
+	Types::TypeDecl* Type() const override;
+	llvm::Value*     CodeGen(llvm::IRBuilder<>& builder) override;
+	ErrorType        Semantics() override;
     };
 
     class FunctionTrim : public FunctionString
@@ -1221,6 +1223,19 @@ namespace Builtin
 
     llvm::Value* FunctionLength::CodeGen(llvm::IRBuilder<>& builder)
     {
+	if (llvm::isa<Types::LongStringDecl>(args[0]->Type()))
+	{
+	    bool                 owned;
+	    llvm::Value*         str = LongStringValue(args[0], owned);
+	    llvm::Type*          intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+	    llvm::FunctionCallee f = GetFunction(intTy, { str->getType() }, "__LStrLength");
+	    llvm::Value*         len = builder.CreateCall(f, { str }, "len");
+	    if (owned)
+	    {
+		ReleaseLongString(str);
+	    }
+	    return len;
+	}
 	llvm::Value* v = MakeAddressable(args[0]);
 	llvm::Type*  charTy = Types::Get<Types::CharDecl>()->LlvmType();
 	v = builder.CreateGEP(charTy, v, MakeIntegerConstant(0), "str_0");
@@ -1235,7 +1250,7 @@ namespace Builtin
 	{
 	    return ErrorType::WrongArgCount;
 	}
-	if (!llvm::isa<Types::StringDecl>(args[0]->Type()))
+	if (!llvm::isa<Types::StringDecl, Types::LongStringDecl>(args[0]->Type()))
 	{
 	    return ErrorType::WrongArgType;
 	}
@@ -1277,8 +1292,33 @@ namespace Builtin
 	return ErrorType::Ok;
     }
 
+    Types::TypeDecl* FunctionCopy::Type() const
+    {
+	if (llvm::isa<Types::LongStringDecl>(args[0]->Type()))
+	{
+	    return args[0]->Type();
+	}
+	return FunctionString::Type();
+    }
+
     llvm::Value* FunctionCopy::CodeGen(llvm::IRBuilder<>& builder)
     {
+	if (llvm::isa<Types::LongStringDecl>(args[0]->Type()))
+	{
+	    bool         owned;
+	    llvm::Value* str = LongStringValue(args[0], owned);
+	    llvm::Value* start = args[1]->CodeGen();
+	    llvm::Value* len = (args.size() == 2) ? MakeIntegerConstant(INT_MAX) : args[2]->CodeGen();
+
+	    std::vector<llvm::Type*> argTypes = { str->getType(), start->getType(), len->getType() };
+	    llvm::FunctionCallee     f = GetFunction(Type()->LlvmType(), argTypes, "__LStrCopy");
+	    llvm::Value*             res = builder.CreateCall(f, { str, start, len }, "copy");
+	    if (owned)
+	    {
+		ReleaseLongString(str);
+	    }
+	    return res;
+	}
 	llvm::Value* str = MakeStringFromExpr(args[0], args[0]->Type());
 	llvm::Value* start = args[1]->CodeGen();
 
@@ -1306,7 +1346,8 @@ namespace Builtin
 	{
 	    return ErrorType::WrongArgCount;
 	}
-	if (!IsStringLike(args[0]->Type()) || !IsIntegral(args[1]->Type()))
+	bool isString = IsStringLike(args[0]->Type()) || llvm::isa<Types::LongStringDecl>(args[0]->Type());
+	if (!isString || !IsIntegral(args[1]->Type()))
 	{
 	    return ErrorType::WrongArgType;
 	}
@@ -1345,6 +1386,11 @@ namespace Builtin
 
     llvm::Value* FunctionIndex::CodeGen(llvm::IRBuilder<>& builder)
     {
+	if (llvm::isa<Types::LongStringDecl>(args[0]->Type()) ||
+	    llvm::isa<Types::LongStringDecl>(args[1]->Type()))
+	{
+	    return CallLongStrFunc("Index", args[0], args[1], Types::Get<Types::IntegerDecl>());
+	}
 	llvm::Value* str1 = MakeStringFromExpr(args[0], args[0]->Type());
 	llvm::Value* str2 = MakeStringFromExpr(args[1], args[1]->Type());
 
@@ -1360,9 +1406,12 @@ namespace Builtin
 	{
 	    return ErrorType::WrongArgCount;
 	}
-	if (!IsStringLike(args[0]->Type()) || !IsStringLike(args[1]->Type()))
+	for (auto a : args)
 	{
-	    return ErrorType::WrongArgType;
+	    if (!IsStringLike(a->Type()) && !llvm::isa<Types::LongStringDecl>(a->Type()))
+	    {
+		return ErrorType::WrongArgType;
+	    }
 	}
 	return ErrorType::Ok;
     }
@@ -1419,14 +1468,32 @@ namespace Builtin
 	}
 
 	llvm::Type* intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+	if (llvm::Type* ty = SetValueType(type))
+	{
+	    llvm::Value* v = LoadSetValue(args[0], ty);
+	    llvm::Value* count = builder.CreateUnaryIntrinsic(llvm::Intrinsic::ctpop, v);
+	    if (ty->isVectorTy())
+	    {
+		count = builder.CreateAddReduce(count);
+	    }
+	    return builder.CreateZExtOrTrunc(count, intTy, "count");
+	}
+
+	llvm::Value* v = MakeAddressable(args[0]);
+	auto         sd = llvm::dyn_cast<Types::SetDecl>(type);
+	if (sd->SetWords() > Types::SetDecl::MaxInlineWords)
+	{
+	    llvm::Type*          pty = llvm::PointerType::getUnqual(theContext);
+	    llvm::FunctionCallee f = GetFunction(intTy, { pty, intTy }, "__SetCard");
+	    return builder.CreateCall(f, { v, MakeIntegerConstant(sd->SetWords()) }, "count");
+	}
+
 	name += std::to_string(Types::SetDecl::SetBits);
-	llvm::Value*         v = MakeAddressable(args[0]);
 	llvm::Value*         addr = builder.CreateGEP(intTy, v, MakeIntegerConstant(0), "leftSet");
 	llvm::Value*         val = builder.CreateLoad(intTy, addr);
 	llvm::Type*          ty = val->getType();
 	llvm::FunctionCallee f = GetFunction(ty, { ty }, name);
 	llvm::Value*         count = builder.CreateCall(f, val, "count");
-	auto                 sd = llvm::dyn_cast<Types::SetDecl>(type);
 	for (size_t i = 1; i < sd->SetWords(); i++)
 	{
 	    addr = builder.CreateGEP(intTy, v, MakeIntegerConstant(i), "leftSet");
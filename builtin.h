@@ -24,12 +24,13 @@ namespace Builtin
     {
     public:
 	FunctionBase(const std::string& nm, const std::vector<ExprAST*>& a) : name(nm), args(a) {}
-	virtual llvm::Value*     CodeGen(llvm::IRBuilder<>& builder) = 0;
-	virtual Types::TypeDecl* Type() const = 0;
-	virtual ErrorType        Semantics() = 0;
-	virtual void             accept(ASTVisitor& v);
-	const std::string&       Name() const { return name; }
-	void                     dump() const;
+	virtual llvm::Value*         CodeGen(llvm::IRBuilder<>& builder) = 0;
+	virtual Types::TypeDecl*     Type() const = 0;
+	virtual ErrorType            Semantics() = 0;
+	virtual void                 accept(ASTVisitor& v);
+	const std::string&           Name() const { return name; }
+	const std::vector<ExprAST*>& Args() const { return args; }
+	void                         dump() const;
 	virtual ~FunctionBase() {}
 
     protected:
@@ -0,0 +1,423 @@
+#include "cache.h"
+#include "binary.h"
+#include "lexer.h"
+#include "options.h"
+#include "source.h"
+#include "token.h"
+#include "trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <map>
+#include <set>
+
+// Key of the current compile, empty if the cache isn't used.
+static std::string cacheKey;
+
+struct CacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+static std::string EntryName(const std::string& key, const std::string& ext)
+{
+    return cacheDir + "/" + key + ext;
+}
+
+static std::string StatsName()
+{
+    return cacheDir + "/stats";
+}
+
+static void HashString(llvm::SHA256& hash, const std::string& str)
+{
+    hash.update(str);
+    // Separator, so that "ab" + "c" and "a" + "bc" differ.
+    hash.update(llvm::StringRef("", 1));
+}
+
+template<typename T>
+static void HashValue(llvm::SHA256& hash, T value)
+{
+    uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    hash.update(llvm::ArrayRef<uint8_t>(bytes, sizeof(T)));
+}
+
+// Hash the tokens of the file, then the units it uses. The interface file of a separately compiled
+// unit is hashed in full, as the header lines are comments to the lexer.
+static bool HashFile(llvm::SHA256& hash, const std::string& fileName, std::set<std::string>& seen)
+{
+    FileSource source(fileName);
+    if (!source)
+    {
+	return false;
+    }
+    Lexer                    lexer(source);
+    std::vector<std::string> units;
+    bool                     inUses = false;
+    for (Token t = lexer.GetToken(); t.GetToken() != Token::EndOfFile; t = lexer.GetToken())
+    {
+	Token::TokenType tt = t.GetToken();
+	HashValue(hash, tt);
+	// Debug info contains the source positions, so they are part of the key.
+	if (debugInfo)
+	{
+	    HashValue(hash, t.Loc().LineNumber());
+	    HashValue(hash, t.Loc().Column());
+	}
+	switch (tt)
+	{
+	case Token::Identifier:
+	{
+	    std::string name = t.GetIdentName();
+	    HashString(hash, name);
+	    if (inUses)
+	    {
+		strlower(name);
+		units.push_back(name);
+	    }
+	    break;
+	}
+	case Token::StringLiteral:
+	    HashString(hash, t.GetStrVal());
+	    break;
+	case Token::Integer:
+	case Token::Char:
+	    HashValue(hash, t.GetIntVal());
+	    break;
+	case Token::Real:
+	    HashValue(hash, t.GetRealVal());
+	    break;
+	default:
+	    break;
+	}
+	if (tt == Token::Uses)
+	{
+	    inUses = true;
+	}
+	else if (tt == Token::Semicolon)
+	{
+	    inUses = false;
+	}
+    }
+
+    std::string path = GetPath(fileName);
+    for (auto u : units)
+    {
+	// The math unit is built into the compiler.
+	if (u == "math" || !seen.insert(path + "/" + u).second)
+	{
+	    continue;
+	}
+	std::string unitName = path + "/" + u + ".pas";
+	std::string ifaceName = path + "/" + u + ".pi";
+	std::string objName = path + "/" + u + ".o";
+	// Same choice as the parser makes.
+	bool useIface = IsUpToDate(ifaceName, unitName) && IsUpToDate(objName, unitName);
+	HashString(hash, u + (useIface ? ".pi" : ".pas"));
+	if (useIface)
+	{
+	    auto buffer = llvm::MemoryBuffer::getFile(ifaceName);
+	    if (!buffer)
+	    {
+		return false;
+	    }
+	    hash.update((*buffer)->getBuffer());
+	}
+	if (!HashFile(hash, useIface ? ifaceName : unitName, seen))
+	{
+	    return false;
+	}
+    }
+    return true;
+}
+
+static void HashOptions(llvm::SHA256& hash)
+{
+    HashValue(hash, optimization);
+    HashValue(hash, model);
+    HashValue(hash, rangeCheck);
+    HashValue(hash, debugInfo);
+    HashValue(hash, disableMemcpyOpt);
+    HashValue(hash, standard);
+    HashValue(hash, caseInsensitive);
+    HashValue(hash, profileGenerate);
+    if (!profileUse.empty())
+    {
+	auto buffer = llvm::MemoryBuffer::getFile(profileUse);
+	HashString(hash, buffer ? (*buffer)->getBuffer().str() : profileUse);
+    }
+    HashValue(hash, runtimeBitcode);
+    HashValue(hash, wholeProgram);
+    HashValue(hash, setValues);
+    // The partitioning for -j doesn't depend on the number of threads.
+    HashValue(hash, codegenThreads > 0);
+    if (runtimeBitcode)
+    {
+	if (auto buffer = llvm::MemoryBuffer::getFile(libpath + "/libruntime.bc"))
+	{
+	    hash.update((*buffer)->getBuffer());
+	}
+    }
+    llvm::TargetMachine* tm = GetTargetMachine();
+    HashString(hash, tm->getTargetTriple().str());
+    HashString(hash, tm->getTargetCPU().str());
+    HashString(hash, tm->getTargetFeatureString().str());
+    HashString(hash, LLVM_VERSION_STRING);
+    // The exact LLVM build, if the llvmversion file is installed next to the compiler.
+    if (auto buffer = llvm::MemoryBuffer::getFile(libpath + "/llvmversion"))
+    {
+	hash.update((*buffer)->getBuffer());
+    }
+}
+
+// The stats file has a line per lookup, "hit" or "miss". Each compile appends its line in a single
+// write, which concurrent compiles can't interleave or lose, as rewriting a count could.
+static CacheStats ReadStats()
+{
+    CacheStats    stats;
+    std::ifstream in(StatsName());
+    std::string   kind;
+    while (in >> kind)
+    {
+	if (kind == "hit")
+	{
+	    stats.hits++;
+	}
+	else if (kind == "miss")
+	{
+	    stats.misses++;
+	}
+    }
+    return stats;
+}
+
+static void UpdateStats(bool hit)
+{
+    std::error_code      ec;
+    llvm::raw_fd_ostream out(StatsName(), ec, llvm::sys::fs::OF_Append);
+    if (!ec)
+    {
+	out << (hit ? "hit\n" : "miss\n");
+    }
+}
+
+// Entries are evicted least recently used first, based on the modification time.
+static void Touch(const std::string& fileName)
+{
+    int fd;
+    if (!llvm::sys::fs::openFileForReadWrite(fileName, fd, llvm::sys::fs::CD_OpenExisting,
+                                             llvm::sys::fs::OF_None))
+    {
+	llvm::sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+	llvm::sys::fs::closeFile(fd);
+    }
+}
+
+// The files of an entry are <key>.o, <key>.objs and, with -j, <key>.part<n> for the other objects.
+struct CacheEntry
+{
+    std::vector<std::string> files;
+    uint64_t                 size = 0;
+    llvm::sys::TimePoint<>   used;
+};
+
+static std::map<std::string, CacheEntry> GetEntries()
+{
+    std::map<std::string, CacheEntry> entries;
+    std::error_code                   ec;
+    for (llvm::sys::fs::directory_iterator it(cacheDir, ec), end; it != end && !ec; it.increment(ec))
+    {
+	std::string name = it->path();
+	std::string base = llvm::sys::path::filename(name).str();
+	std::string key = base.substr(0, base.find('.'));
+	llvm::sys::fs::file_status st;
+	if (base == "stats" || llvm::sys::path::extension(name) == ".tmp" || llvm::sys::fs::status(name, st))
+	{
+	    continue;
+	}
+	CacheEntry& e = entries[key];
+	e.files.push_back(name);
+	e.size += st.getSize();
+	// An entry without an object is incomplete, those are evicted first.
+	if (llvm::sys::path::extension(name) == ".o")
+	{
+	    e.used = st.getLastModificationTime();
+	}
+    }
+    return entries;
+}
+
+static void Evict()
+{
+    std::map<std::string, CacheEntry> entries = GetEntries();
+    uint64_t                          total = 0;
+    std::vector<std::string>          keys;
+    for (auto& e : entries)
+    {
+	total += e.second.size;
+	keys.push_back(e.first);
+    }
+    uint64_t limit = static_cast<uint64_t>(cacheSize) * 1024 * 1024;
+    if (total <= limit)
+    {
+	return;
+    }
+    std::sort(keys.begin(), keys.end(), [&entries](const std::string& a, const std::string& b)
+              { return entries[a].used < entries[b].used; });
+    for (auto& k : keys)
+    {
+	if (total <= limit)
+	{
+	    break;
+	}
+	if (verbosity)
+	{
+	    std::cerr << "Cache evict: " << k << std::endl;
+	}
+	for (auto& f : entries[k].files)
+	{
+	    llvm::sys::fs::remove(f);
+	}
+	total -= entries[k].size;
+    }
+}
+
+// Copy via a temporary file, so that a concurrent compile never sees a partial file.
+static bool CopyIntoCache(const std::string& from, const std::string& to)
+{
+    llvm::SmallString<128> tmpName;
+    if (llvm::sys::fs::createUniqueFile(to + ".%%%%%%.tmp", tmpName))
+    {
+	return false;
+    }
+    if (llvm::sys::fs::copy_file(from, tmpName) || llvm::sys::fs::rename(tmpName, to))
+    {
+	llvm::sys::fs::remove(tmpName);
+	return false;
+    }
+    return true;
+}
+
+static std::string PartName(size_t index)
+{
+    return EntryName(cacheKey, ".part" + std::to_string(index));
+}
+
+bool CacheLookup(const std::string& fileName, std::vector<std::string>& objNames)
+{
+    TIME_TRACE();
+    if (std::error_code ec = llvm::sys::fs::create_directories(cacheDir))
+    {
+	std::cerr << "Could not create cache directory " << cacheDir << ": " << ec.message() << std::endl;
+	return false;
+    }
+    llvm::SHA256          hash;
+    std::set<std::string> seen;
+    HashOptions(hash);
+    // Debug info and the profile file name depend on where the source is.
+    if (debugInfo || profileGenerate)
+    {
+	llvm::SmallString<128> path(fileName);
+	llvm::sys::fs::make_absolute(path);
+	HashString(hash, path.str().str());
+    }
+    if (!HashFile(hash, fileName, seen))
+    {
+	return false;
+    }
+    cacheKey = llvm::toHex(hash.final(), true);
+
+    std::string   objName = EntryName(cacheKey, ".o");
+    std::ifstream objs(EntryName(cacheKey, ".objs"));
+    bool          hit = objs && llvm::sys::fs::exists(objName);
+    if (hit)
+    {
+	objNames = { objName };
+	for (size_t i = 1; llvm::sys::fs::exists(PartName(i)); i++)
+	{
+	    objNames.push_back(PartName(i));
+	}
+	std::string line;
+	while (std::getline(objs, line))
+	{
+	    AddLinkObject(line);
+	}
+	Touch(objName);
+    }
+    if (verbosity)
+    {
+	std::cerr << "Cache " << (hit ? "hit" : "miss") << ": " << cacheKey << std::endl;
+    }
+    UpdateStats(hit);
+    return hit;
+}
+
+void CacheStore(const std::vector<std::string>& objNames, const std::vector<std::string>& linkObjects)
+{
+    TIME_TRACE();
+    if (cacheKey.empty())
+    {
+	return;
+    }
+    for (size_t i = 1; i < objNames.size(); i++)
+    {
+	if (!CopyIntoCache(objNames[i], PartName(i)))
+	{
+	    return;
+	}
+    }
+    llvm::SmallString<128> tmpName;
+    std::string            objsName = EntryName(cacheKey, ".objs");
+    if (llvm::sys::fs::createUniqueFile(objsName + ".%%%%%%.tmp", tmpName))
+    {
+	return;
+    }
+    {
+	std::ofstream out(tmpName.str().str());
+	for (auto o : linkObjects)
+	{
+	    out << o << "\n";
+	}
+    }
+    // The main object goes in last, as an entry is only complete once it is there.
+    if (llvm::sys::fs::rename(tmpName, objsName) || !CopyIntoCache(objNames[0], EntryName(cacheKey, ".o")))
+    {
+	llvm::sys::fs::remove(tmpName);
+	return;
+    }
+    Evict();
+}
+
+void CachePrintStats()
+{
+    CacheStats                        stats = ReadStats();
+    std::map<std::string, CacheEntry> entries = GetEntries();
+    uint64_t                          size = 0;
+    for (auto& e : entries)
+    {
+	size += e.second.size;
+    }
+    uint64_t total = stats.hits + stats.misses;
+    std::cerr << "Cache directory: " << cacheDir << "\n"
+              << "Hits:            " << stats.hits << "\n"
+              << "Misses:          " << stats.misses << "\n"
+              << "Hit rate:        " << (total ? stats.hits * 100 / total : 0) << "%\n"
+              << "Entries:         " << entries.size() << "\n"
+              << "Size:            " << size / 1024 << " KiB of " << cacheSize << " MiB" << std::endl;
+}
@@ -0,0 +1,18 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+#include <vector>
+
+// Object file cache, enabled with -cache-dir. Entries are keyed on a hash of the token stream of
+// the program and the units it uses, and the options that affect code generation.
+
+// Compute the key for fileName. Returns true on a hit, with objNames set to the cached objects.
+bool CacheLookup(const std::string& fileName, std::vector<std::string>& objNames);
+
+// Store the objects produced on a miss, along with the unit objects they need when linking.
+void CacheStore(const std::vector<std::string>& objNames, const std::vector<std::string>& linkObjects);
+
+void CachePrintStats();
+
+#endif
@@ -74,15 +74,9 @@ void CallGraphPrinter::Caller(FunctionAST* f)
 
 void AddClosureArg(FunctionAST* fn, std::vector<ExprAST*>& args)
 {
-    if (Types::TypeDecl* closureTy = fn->ClosureType())
+    if (fn->ClosureType())
     {
-	std::vector<VariableExprAST*> vf;
-	for (auto u : fn->UsedVars())
-	{
-	    vf.push_back(new VariableExprAST(fn->Loc(), u.Name(), u.Type()));
-	}
-	ClosureAST* closure = new ClosureAST(fn->Loc(), closureTy, vf);
-	args.insert(args.begin(), closure);
+	args.insert(args.begin(), new ClosureAST(fn->Loc(), fn));
     }
 }
 
@@ -124,12 +118,21 @@ public:
     void Caller(FunctionAST* f) override { CollectUseData(f); }
     void VarDecl(VarDeclAST* v) override { AddVarDecls(v->Vars(), v->Function()); }
 
-    void AddVarDecls(const std::vector<VarDef>& vars, FunctionAST* f);
-    void CollectUseData(FunctionAST* f);
+    void   AddVarDecls(const std::vector<VarDef>& vars, FunctionAST* f);
+    void   CollectUseData(FunctionAST* f);
+    VarSet TransitiveWrites(const FunctionAST* f);
 
     std::map<const FunctionAST*, VarSet>  useMap;
     std::map<const FunctionAST*, VarMap>  declMap;
     std::map<const FunctionAST*, CallSet> callMap;
+    std::map<const FunctionAST*, VarSet>  writeMap;
+    // Names passed as var arguments anywhere.
+    VarSet refs;
+    // Functions passed as procedural arguments, and the functions they are passed to, which may
+    // run at any time while the closure is alive.
+    CallSet escapes;
+    // Functions whose closure is kept somewhere other than an argument.
+    CallSet stored;
 };
 
 class CollectUses : public ASTVisitor
@@ -155,17 +158,88 @@ public:
 	}
 	if (auto c = llvm::dyn_cast<CallExprAST>(a))
 	{
+	    callees.insert(c->Callee());
+	    FunctionAST* callee = nullptr;
 	    if (auto fe = llvm::dyn_cast<FunctionExprAST>(c->Callee()))
 	    {
-		if (auto fn = fe->Proto()->Function())
+		if ((callee = fe->Proto()->Function()))
+		{
+		    calls.insert(callee);
+		}
+	    }
+	    const std::vector<VarDef>& params = c->Proto()->Args();
+	    for (size_t i = 0; i < c->Args().size(); i++)
+	    {
+		ExprAST* arg = c->Args()[i];
+		if (i < params.size() && params[i].IsRef())
+		{
+		    AddWrite(arg, true);
+		}
+		// The callee may call a function passed to it at any time.
+		if (llvm::isa<FunctionExprAST>(arg))
 		{
-		    calls.insert(fn);
+		    passed.insert(arg);
+		    if (callee)
+		    {
+			holders.insert(callee);
+		    }
 		}
 	    }
 	}
+	if (auto fe = llvm::dyn_cast<FunctionExprAST>(a))
+	{
+	    funcs.push_back(fe);
+	}
+	if (auto as = llvm::dyn_cast<AssignExprAST>(a))
+	{
+	    AddWrite(as->Lhs(), false);
+	}
+	if (auto fe = llvm::dyn_cast<ForExprAST>(a))
+	{
+	    AddWrite(fe->Variable(), false);
+	}
+	if (auto r = llvm::dyn_cast<ReadAST>(a))
+	{
+	    for (auto arg : r->Args())
+	    {
+		AddWrite(arg, false);
+	    }
+	}
+	// Builtin procedures, such as inc or new, may write their arguments.
+	if (auto b = llvm::dyn_cast<BuiltinExprAST>(a); b && llvm::isa<Types::VoidDecl>(b->Type()))
+	{
+	    for (auto arg : b->Args())
+	    {
+		AddWrite(arg, false);
+	    }
+	}
+    }
+
+    // Only whole variables are of interest, as only simple types are captured by value.
+    void AddWrite(ExprAST* e, bool isRef)
+    {
+	if (auto tc = llvm::dyn_cast<TypeCastAST>(e))
+	{
+	    e = tc->Expr();
+	}
+	if (auto v = llvm::dyn_cast<VariableExprAST>(e))
+	{
+	    writes.insert(v->Name());
+	    if (isRef)
+	    {
+		refs.insert(v->Name());
+	    }
+	}
     }
-    CallSet calls;
-    VarSet  uses;
+
+    CallSet                       calls;
+    CallSet                       holders;
+    VarSet                        uses;
+    VarSet                        writes;
+    VarSet                        refs;
+    std::set<const ExprAST*>      callees;
+    std::set<const ExprAST*>      passed;
+    std::vector<FunctionExprAST*> funcs;
 };
 
 void CallGraphClosureCollector::AddVarDecls(const std::vector<VarDef>& vars, FunctionAST* f)
@@ -189,6 +263,47 @@ void CallGraphClosureCollector::CollectUseData(FunctionAST* f)
     AddVarDecls(f->Proto()->Args(), f);
     useMap[f] = collector.uses;
     callMap[f] = collector.calls;
+    writeMap[f] = collector.writes;
+    refs.insert(collector.refs.begin(), collector.refs.end());
+    escapes.insert(collector.holders.begin(), collector.holders.end());
+    for (auto fe : collector.funcs)
+    {
+	FunctionAST* fn = fe->Proto()->Function();
+	if (fn && !collector.callees.count(fe))
+	{
+	    escapes.insert(fn);
+	    // Kept somewhere other than an argument, so may outlive the values it would copy.
+	    if (!collector.passed.count(fe))
+	    {
+		stored.insert(fn);
+	    }
+	}
+    }
+}
+
+// Everything that f, or anything it calls, may write.
+VarSet CallGraphClosureCollector::TransitiveWrites(const FunctionAST* f)
+{
+    VarSet                          writes;
+    CallSet                         seen;
+    std::vector<const FunctionAST*> work = { f };
+    while (!work.empty())
+    {
+	const FunctionAST* g = work.back();
+	work.pop_back();
+	if (seen.insert(g).second)
+	{
+	    writes.insert(writeMap[g].begin(), writeMap[g].end());
+	    work.insert(work.end(), callMap[g].begin(), callMap[g].end());
+	}
+    }
+    return writes;
+}
+
+static bool CanCaptureByValue(const VarDef& v)
+{
+    const Types::TypeDecl* ty = v.Type();
+    return !v.IsRef() && (Types::IsIntegral(ty) || llvm::isa<Types::RealDecl, Types::PointerDecl>(ty));
 }
 
 void RemoveFromUses(VarSet& uses, const VarMap& decls)
@@ -209,10 +324,20 @@ void AddToUses(VarSet& uses, VarSet& more)
 
 void BuildClosures(ExprAST* ast)
 {
+    TIME_TRACE();
     TRACE();
     CallGraphClosureCollector v;
     CallGraph(ast, v);
 
+    // A variable passed by reference may be written under another name, and what escaping
+    // functions write may change at any time, so neither can be captured by value anywhere.
+    VarSet unsafe = v.refs;
+    for (auto f : v.escapes)
+    {
+	VarSet writes = v.TransitiveWrites(f);
+	AddToUses(unsafe, writes);
+    }
+
     for (auto usage : v.useMap)
     {
 	VarSet       uses = usage.second;
@@ -254,6 +379,24 @@ void BuildClosures(ExprAST* ast)
 	}
 
 	func->SetUsedVars(used);
+
+	// Copy the captures that nothing writes while func runs, rather than pointing at them.
+	VarSet writes = v.TransitiveWrites(func);
+	VarSet byValue;
+	bool   stored = v.stored.count(func);
+	for (auto u : used)
+	{
+	    if (!stored && CanCaptureByValue(u) && !writes.count(u.Name()) && !unsafe.count(u.Name()))
+	    {
+		if (verbosity)
+		{
+		    std::cerr << "Capturing " << u.Name() << " by value in " << func->Proto()->Name()
+		              << std::endl;
+		}
+		byValue.insert(u.Name());
+	    }
+	}
+	func->SetValueCaptures(byValue);
 	if (Types::TypeDecl* closure = func->ClosureType())
 	{
 	    func->Proto()->AddExtraArgsFirst(
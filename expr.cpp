@@ -21,20 +21,19 @@
 #include <cctype>
 #include <iostream>
 #include <map>
+#include <set>
 #include <sstream>
 
 #if !NDEBUG
 template<>
 void Stack<llvm::Value*>::dump() const
 {
-    int n = 0;
-    for (auto s : stack)
+    for (size_t n = 0; n <= MaxLevel(); n++)
     {
 	std::cerr << "Level " << n << std::endl;
-	n++;
-	for (auto v : s)
+	for (auto& v : GetLevel(n))
 	{
-	    std::cerr << v.first << ": ";
+	    std::cerr << *v.first << ": ";
 	    v.second->dump();
 	    std::cerr << std::endl;
 	}
@@ -81,6 +80,8 @@ static llvm::IRBuilder<>         builder(theContext);
 static int                       errCnt;
 static std::vector<VTableAST*>   vtableBackPatchList;
 static std::vector<FunctionAST*> unitInit;
+static unsigned                  devirtualisedCalls;
+static unsigned                  guardedCalls;
 
 // Debug stack. We just use push_back and pop_back to make it like a stack.
 static std::vector<DebugInfo*> debugStack;
@@ -143,11 +144,122 @@ static llvm::BasicBlock* CreateGotoTarget(int label)
     return bb;
 }
 
+// What the runtime library functions do, so that the optimiser can hoist, combine and remove calls
+// to them. None of them keep the pointers passed to them, other than by returning them. Functions
+// that can end in __Panic (out of memory, index out of range) are not Returns, as they may not.
+struct RuntimeFunc
+{
+    enum Flags
+    {
+	Returns = 1 << 0,  // nounwind willreturn
+	NoReturn = 1 << 1, // nounwind noreturn cold
+	Malloc = 1 << 2,   // Result is noalias nonnull
+	RetArg = 1 << 3,   // Result points into the first argument
+    };
+    llvm::MemoryEffects mem;
+    unsigned            flags;
+};
+
+static const RuntimeFunc* FindRuntimeFunc(const std::string& name)
+{
+    using ME = llvm::MemoryEffects;
+    static const ME argRead = ME::argMemOnly(llvm::ModRefInfo::Ref);
+    static const ME argReadWrite = ME::argMemOnly();
+    // libm may set errno, and malloc has its own state, neither of which the program can see.
+    static const ME other = ME::inaccessibleMemOnly();
+    static const ME argOrOther = ME::inaccessibleOrArgMemOnly();
+
+    static const std::map<std::string, RuntimeFunc> table = {
+	{ "__SetEqual", { argRead, RuntimeFunc::Returns } },
+	{ "__SetContains", { argRead, RuntimeFunc::Returns } },
+	{ "__SetUnion", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__SetDiff", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__SetIntersect", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__SetSymDiff", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__SetCard", { argRead, RuntimeFunc::Returns } },
+	{ "__SetConvert", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__StrCompare", { argRead, RuntimeFunc::Returns } },
+	{ "__StrIndex", { argRead, RuntimeFunc::Returns } },
+	{ "__StrConcat", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__StrAssign", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__StrTrim", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__ArrCompare", { argRead, RuntimeFunc::Returns } },
+	{ "__LStrCompare", { argRead, RuntimeFunc::Returns } },
+	{ "__LStrIndex", { argRead, RuntimeFunc::Returns } },
+	{ "__LStrLength", { argRead, RuntimeFunc::Returns } },
+	{ "__LStrToStr", { argReadWrite, RuntimeFunc::Returns } },
+	{ "__LStrFromStr", { argOrOther, 0 } },
+	{ "__LStrCharAddr", { argRead, RuntimeFunc::RetArg } },
+	{ "__LStrRelease", { argOrOther, RuntimeFunc::Returns } },
+	{ "__frac", { ME::none(), RuntimeFunc::Returns } },
+	{ "__carg", { other, RuntimeFunc::Returns } },
+	{ "__csqrt", { argOrOther, RuntimeFunc::Returns } },
+	{ "__csin", { argOrOther, RuntimeFunc::Returns } },
+	{ "__ccos", { argOrOther, RuntimeFunc::Returns } },
+	{ "__ctan", { argOrOther, RuntimeFunc::Returns } },
+	{ "__cexp", { argOrOther, RuntimeFunc::Returns } },
+	{ "__clog", { argOrOther, RuntimeFunc::Returns } },
+	{ "__catan", { argOrOther, RuntimeFunc::Returns } },
+	{ "__cpolar", { argOrOther, RuntimeFunc::Returns } },
+	{ "__cpow", { argOrOther, RuntimeFunc::Returns } },
+	{ "__new", { other, RuntimeFunc::Malloc } },
+	{ "__dispose", { argOrOther, RuntimeFunc::Returns } },
+	{ "__Clock", { other, RuntimeFunc::Returns } },
+	{ "__Panic", { ME::unknown(), RuntimeFunc::NoReturn } },
+	{ "range_error", { ME::unknown(), RuntimeFunc::NoReturn } },
+    };
+    auto it = table.find(name);
+    return (it != table.end()) ? &it->second : 0;
+}
+
+static void AddRuntimeAttributes(llvm::Function* fn)
+{
+    const RuntimeFunc* rf = FindRuntimeFunc(fn->getName().str());
+    if (!rf)
+    {
+	return;
+    }
+
+    fn->setMemoryEffects(rf->mem);
+    fn->setDoesNotThrow();
+    if (rf->flags & RuntimeFunc::Returns)
+    {
+	fn->setWillReturn();
+    }
+    if (rf->flags & RuntimeFunc::NoReturn)
+    {
+	fn->setDoesNotReturn();
+	fn->addFnAttr(llvm::Attribute::Cold);
+    }
+    if (rf->flags & RuntimeFunc::Malloc)
+    {
+	fn->addRetAttr(llvm::Attribute::NoAlias);
+	fn->addRetAttr(llvm::Attribute::NonNull);
+    }
+    for (auto& arg : fn->args())
+    {
+	if (arg.getType()->isPointerTy())
+	{
+	    llvm::CaptureInfo ci = llvm::CaptureInfo::none();
+	    if ((rf->flags & RuntimeFunc::RetArg) && arg.getArgNo() == 0)
+	    {
+		ci = llvm::CaptureInfo(llvm::CaptureComponents::None, llvm::CaptureComponents::All);
+	    }
+	    arg.addAttr(llvm::Attribute::getWithCaptureInfo(theContext, ci));
+	}
+    }
+}
+
 llvm::FunctionCallee GetFunction(llvm::Type* resTy, const std::vector<llvm::Type*>& args,
                                  const std::string& name)
 {
-    llvm::FunctionType* ft = llvm::FunctionType::get(resTy, args, false);
-    return theModule->getOrInsertFunction(name, ft);
+    llvm::FunctionType*  ft = llvm::FunctionType::get(resTy, args, false);
+    llvm::FunctionCallee fc = theModule->getOrInsertFunction(name, ft);
+    if (auto fn = llvm::dyn_cast<llvm::Function>(fc.getCallee()); fn && fn->isDeclaration())
+    {
+	AddRuntimeAttributes(fn);
+    }
+    return fc;
 }
 
 static llvm::FunctionCallee GetFunction(Types::TypeDecl* res, const std::vector<llvm::Type*>& args,
@@ -163,10 +275,29 @@ static bool IsConstant(ExprAST* e)
     return llvm::isa<IntegerExprAST, CharExprAST>(e);
 }
 
+static bool IsConstantElement(ExprAST* v)
+{
+    if (auto r = llvm::dyn_cast<RangeExprAST>(v))
+    {
+	return IsConstant(r->LowExpr()) && IsConstant(r->HighExpr());
+    }
+    return IsConstant(v);
+}
+
+// The value of a constant set element, with characters taken as unsigned.
+static int64_t ConstantElement(ExprAST* e)
+{
+    auto ie = llvm::dyn_cast<IntegerExprAST>(e);
+    if (llvm::isa<CharExprAST>(ie))
+    {
+	return static_cast<unsigned char>(ie->Int());
+    }
+    return static_cast<int64_t>(ie->Int());
+}
+
 size_t AlignOfType(llvm::Type* ty)
 {
-    const llvm::DataLayout& dl = theModule->getDataLayout();
-    return dl.getPrefTypeAlign(ty).value();
+    return Types::PrefAlignOf(ty);
 }
 
 static llvm::AllocaInst* CreateNamedAlloca(llvm::Function* fn, Types::TypeDecl* ty, const std::string& name)
@@ -437,7 +568,7 @@ void VariableExprAST::DoDump() const
 llvm::Value* VariableExprAST::Address()
 {
     TRACE();
-    if (llvm::Value* v = variables.Find(name))
+    if (llvm::Value* v = variables.Find(ident))
     {
 	EnsureSized();
 	return v;
@@ -721,36 +852,101 @@ static llvm::Value* SetOperation(const std::string& name, llvm::Value* res, llvm
     ICE("Unknown set operation");
 }
 
-llvm::Value* BinaryExprAST::InlineSetFunc(const std::string& name)
+llvm::Type* SetValueType(Types::TypeDecl* ty)
 {
-    if (optimization >= O1 && (name == "Union" || name == "Intersect" || name == "Diff" || name == "SymDiff"))
+    auto sd = llvm::dyn_cast_or_null<Types::SetDecl>(ty);
+    if (!sd || optimization < O1 || !setValues || sd->SetWords() > Types::SetDecl::MaxInlineWords)
     {
-	Types::TypeDecl* type = rhs->Type();
+	return 0;
+    }
+    size_t bits = sd->SetWords() * Types::SetDecl::SetBits;
+    if (bits <= 64)
+    {
+	return llvm::IntegerType::get(theContext, bits);
+    }
+    return llvm::FixedVectorType::get(Types::Get<Types::IntegerDecl>()->LlvmType(), sd->SetWords());
+}
 
-	ICE_IF(*type != *lhs->Type(), "Expect same types");
-	llvm::Value* rV = MakeAddressable(rhs);
-	llvm::Value* lV = MakeAddressable(lhs);
+llvm::Value* LoadSetValue(ExprAST* e, llvm::Type* ty)
+{
+    if (auto b = llvm::dyn_cast<BinaryExprAST>(e))
+    {
+	if (llvm::Value* v = b->SetValue())
+	{
+	    return v;
+	}
+    }
+    // Sets are only word aligned, so the integer or vector must not assume its natural alignment.
+    return builder.CreateAlignedLoad(ty, MakeAddressable(e), llvm::Align(sizeof(Types::SetDecl::ElemType)),
+                                     "setval");
+}
 
-	size_t words = llvm::dyn_cast<Types::SetDecl>(type)->SetWords();
-	ICE_IF(!rV || !lV, "Should have generated values for left and right set");
+static llvm::Value* IsEmptySetValue(llvm::Value* v)
+{
+    if (v->getType()->isVectorTy())
+    {
+	v = builder.CreateOrReduce(v);
+    }
+    return builder.CreateICmpEQ(v, llvm::Constant::getNullValue(v->getType()), "empty");
+}
 
-	llvm::Type* ty = Types::Get<Types::IntegerDecl>()->LlvmType();
+llvm::Value* BinaryExprAST::SetValue()
+{
+    llvm::Type* ty = SetValueType(lhs->Type());
+    if (!ty)
+    {
+	return 0;
+    }
 
-	llvm::Value* v = CreateTempAlloca(type);
-	for (size_t i = 0; i < words; i++)
+    std::string name;
+    switch (oper.GetToken())
+    {
+    case Token::Plus:
+	name = "Union";
+	break;
+    case Token::Multiply:
+	name = "Intersect";
+	break;
+    case Token::Minus:
+	name = "Diff";
+	break;
+    case Token::SymDiff:
+	name = "SymDiff";
+	break;
+    default:
+	return 0;
+    }
+
+    ICE_IF(*lhs->Type() != *rhs->Type(), "Expect same types");
+    llvm::Value* l = LoadSetValue(lhs, ty);
+    llvm::Value* r = LoadSetValue(rhs, ty);
+    return SetOperation(name, l, r);
+}
+
+llvm::Value* BinaryExprAST::InlineSetFunc(const std::string& name)
+{
+    Types::TypeDecl* type = rhs->Type();
+    llvm::Type*      ty = SetValueType(type);
+    if (!ty)
+    {
+	return 0;
+    }
+
+    ICE_IF(*type != *lhs->Type(), "Expect same types");
+    if (name == "Equal" || name == "Contains")
+    {
+	llvm::Value* l = LoadSetValue(lhs, ty);
+	llvm::Value* r = LoadSetValue(rhs, ty);
+	if (name == "Equal")
 	{
-	    llvm::Value* ind = MakeIntegerConstant(i);
-	    llvm::Value* lAddr = builder.CreateGEP(ty, lV, ind, "leftSet");
-	    llvm::Value* rAddr = builder.CreateGEP(ty, rV, ind, "rightSet");
-	    llvm::Value* vAddr = builder.CreateGEP(ty, v, ind, "resSet");
-	    llvm::Value* res = builder.CreateLoad(ty, lAddr, "laddr");
-	    llvm::Value* tmp = builder.CreateLoad(ty, rAddr, "raddr");
-	    res = SetOperation(name, res, tmp);
-	    builder.CreateStore(res, vAddr);
+	    return IsEmptySetValue(builder.CreateXor(l, r));
 	}
-	return builder.CreateLoad(type->LlvmType(), v, "set");
+	return IsEmptySetValue(builder.CreateAnd(l, builder.CreateNot(r)));
     }
-    return 0;
+
+    llvm::Value* v = CreateTempAlloca(type);
+    builder.CreateAlignedStore(SetValue(), v, llvm::Align(sizeof(Types::SetDecl::ElemType)));
+    return builder.CreateLoad(type->LlvmType(), v, "set");
 }
 
 llvm::Value* BinaryExprAST::CallSetFunc(const std::string& name, Types::TypeDecl* resTy)
@@ -788,6 +984,168 @@ llvm::Value* BinaryExprAST::CallSetFunc(const std::string& name, Types::TypeDecl
     return builder.CreateCall(f, { lV, rV, setWords }, "calltmp");
 }
 
+// The heap block of a long string with room for len characters, as LongString in the runtime.
+static llvm::StructType* LongStringBlockType(size_t len)
+{
+    llvm::Type* intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    llvm::Type* charTy = Types::Get<Types::CharDecl>()->LlvmType();
+    return llvm::StructType::get(theContext, { intTy, intTy, intTy, llvm::ArrayType::get(charTy, len) });
+}
+
+// A string constant becomes a constant block, which the runtime never changes or frees, so using it
+// as a long string doesn't allocate anything.
+static llvm::Value* LongStringConstant(const std::string& str)
+{
+    if (str.empty())
+    {
+	return llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(theContext));
+    }
+    llvm::StructType* ty = LongStringBlockType(str.size());
+    llvm::Constant*   len = MakeIntegerConstant(str.size());
+    llvm::Constant*   chars = llvm::ConstantDataArray::getString(theContext, str, false);
+    llvm::Constant*   init = llvm::ConstantStruct::get(ty, { MakeIntegerConstant(-1), len, len, chars });
+
+    auto gv = new llvm::GlobalVariable(*theModule, ty, true, llvm::GlobalValue::PrivateLinkage, init, "lstr");
+    gv->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return gv;
+}
+
+static llvm::Value* CallLongStr(const std::string& name, Types::TypeDecl* resTy,
+                                const std::vector<llvm::Value*>& args)
+{
+    std::vector<llvm::Type*> argTypes;
+    for (auto a : args)
+    {
+	argTypes.push_back(a->getType());
+    }
+    llvm::FunctionCallee f = GetFunction(resTy->LlvmType(), argTypes, "__LStr" + name);
+    return builder.CreateCall(f, args);
+}
+
+void ReleaseLongString(llvm::Value* v)
+{
+    CallLongStr("Release", Types::Get<Types::VoidDecl>(), { v });
+}
+
+llvm::Value* LongStringValue(ExprAST* e, bool& owned)
+{
+    auto tc = llvm::dyn_cast<TypeCastAST>(e);
+    if (tc && llvm::isa<Types::LongStringDecl>(tc->Type()))
+    {
+	e = tc->Expr();
+    }
+
+    owned = false;
+    if (auto se = llvm::dyn_cast<StringExprAST>(e))
+    {
+	return LongStringConstant(se->Str());
+    }
+    if (auto ce = llvm::dyn_cast<CharExprAST>(e))
+    {
+	return LongStringConstant(std::string(1, static_cast<char>(ce->Int())));
+    }
+    auto ve = llvm::dyn_cast<VariableExprAST>(e);
+    if (ve && llvm::isa<Types::LongStringDecl>(ve->Type()))
+    {
+	return builder.CreateLoad(ve->Type()->LlvmType(), ve->Address(), ve->Name());
+    }
+
+    owned = true;
+    if (!llvm::isa<Types::LongStringDecl>(e->Type()))
+    {
+	llvm::Value* str = MakeStringFromExpr(e, e->Type());
+	return CallLongStr("FromStr", Types::Get<Types::LongStringDecl>(), { str });
+    }
+    return e->CodeGen();
+}
+
+// A long string value for the caller to hand over, such as to a value parameter.
+static llvm::Value* LongStringOwned(ExprAST* e)
+{
+    bool         owned;
+    llvm::Value* v = LongStringValue(e, owned);
+    if (!owned)
+    {
+	v = CallLongStr("AddRef", Types::Get<Types::LongStringDecl>(), { v });
+    }
+    return v;
+}
+
+// Convert a long string to a short string at dest, truncated to capacity.
+static llvm::Value* LongStringToShort(llvm::Value* dest, ExprAST* e, int capacity)
+{
+    bool         owned;
+    llvm::Value* v = LongStringValue(e, owned);
+    llvm::Value* res = CallLongStr("ToStr", Types::Get<Types::VoidDecl>(),
+                                   { dest, v, MakeIntegerConstant(capacity) });
+    if (owned)
+    {
+	ReleaseLongString(v);
+    }
+    return res;
+}
+
+llvm::Value* CallLongStrFunc(const std::string& name, ExprAST* lhs, ExprAST* rhs, Types::TypeDecl* resTy)
+{
+    TRACE();
+    bool         lOwned;
+    bool         rOwned;
+    llvm::Value* lV = LongStringValue(lhs, lOwned);
+    llvm::Value* rV = LongStringValue(rhs, rOwned);
+    llvm::Value* res = CallLongStr(name, resTy, { lV, rV });
+    if (lOwned)
+    {
+	ReleaseLongString(lV);
+    }
+    if (rOwned)
+    {
+	ReleaseLongString(rV);
+    }
+    return res;
+}
+
+void LongStringIndexAST::DoDump() const
+{
+    std::cerr << "LongStringIndex: ";
+    expr->DoDump();
+    std::cerr << "[";
+    index->DoDump();
+    std::cerr << "]";
+}
+
+// The runtime checks the index against the length, which also catches the empty string, as that
+// has no block to index.
+static llvm::Value* LongStringCharAddress(llvm::Value* str, ExprAST* index)
+{
+    llvm::Type*          intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    llvm::Type*          pty = llvm::PointerType::getUnqual(theContext);
+    llvm::Value*         idx = builder.CreateSExtOrTrunc(index->CodeGen(), intTy);
+    llvm::FunctionCallee f = GetFunction(pty, { str->getType(), intTy }, "__LStrCharAddr");
+    return builder.CreateCall(f, { str, idx }, "charaddr");
+}
+
+llvm::Value* LongStringIndexAST::CodeGen()
+{
+    TRACE();
+    bool         owned;
+    llvm::Value* str = LongStringValue(expr, owned);
+    llvm::Value* v = builder.CreateLoad(type->LlvmType(), LongStringCharAddress(str, index), "char");
+    if (owned)
+    {
+	ReleaseLongString(str);
+    }
+    return v;
+}
+
+llvm::Value* LongStringIndexAST::Address()
+{
+    TRACE();
+    auto ae = llvm::dyn_cast<AddressableAST>(expr);
+    ICE_IF(!ae, "Expected addressable long string");
+    llvm::Value* str = CallLongStr("Unique", Types::Get<Types::LongStringDecl>(), { ae->Address() });
+    return LongStringCharAddress(str, index);
+}
+
 llvm::Value* MakeStringFromExpr(ExprAST* e, Types::TypeDecl* ty)
 {
     TRACE();
@@ -809,6 +1167,14 @@ llvm::Value* MakeStringFromExpr(ExprAST* e, Types::TypeDecl* ty)
 	return MakeAddressable(e);
     }
 
+    if (llvm::isa<Types::LongStringDecl>(e->Type()))
+    {
+	auto         sty = llvm::cast<Types::StringDecl>(Types::Get<Types::StringDecl>(255));
+	llvm::Value* v = CreateTempAlloca(sty);
+	LongStringToShort(v, e, sty->Capacity());
+	return v;
+    }
+
     if (IsCharArray(e->Type()))
     {
 	auto                               ea = llvm::dyn_cast<AddressableAST>(e);
@@ -839,6 +1205,11 @@ llvm::Value* CallStrFunc(const std::string& name, ExprAST* lhs, ExprAST* rhs, Ty
 static llvm::Value* CallStrCat(ExprAST* lhs, ExprAST* rhs)
 {
     TRACE();
+    if (llvm::isa<Types::LongStringDecl>(lhs->Type()) || llvm::isa<Types::LongStringDecl>(rhs->Type()))
+    {
+	return CallLongStrFunc("Concat", lhs, rhs, Types::Get<Types::LongStringDecl>());
+    }
+
     llvm::Value* rV = MakeStringFromExpr(rhs, rhs->Type());
     llvm::Value* lV = MakeStringFromExpr(lhs, lhs->Type());
 
@@ -916,11 +1287,93 @@ Types::TypeDecl* BinaryExprAST::Type() const
     return lhs->Type();
 }
 
+// "x in [...]" with a set literal tests x against the elements and ranges directly, rather than build
+// the set. Constant elements that fit in 64 bits are tested with one shift of an immediate, other
+// constant ranges with an unsigned compare of x - low against high - low.
+static llvm::Value* InSetLiteral(ExprAST* lhs, SetExprAST* set)
+{
+    llvm::Type*  i64Ty = llvm::Type::getInt64Ty(theContext);
+    bool         isSigned = !Types::IsUnsigned(lhs->Type());
+    llvm::Value* x = builder.CreateIntCast(lhs->CodeGen(), i64Ty, isSigned, "x");
+    llvm::Value* res = MakeBooleanConstant(0);
+
+    std::vector<std::pair<int64_t, int64_t>> constants;
+    for (auto v : set->Values())
+    {
+	auto r = llvm::dyn_cast<RangeExprAST>(v);
+	if (IsConstantElement(v))
+	{
+	    int64_t low = ConstantElement(r ? r->LowExpr() : v);
+	    int64_t high = ConstantElement(r ? r->HighExpr() : v);
+	    if (low <= high)
+	    {
+		constants.push_back({ low, high });
+	    }
+	    continue;
+	}
+	llvm::Value* in;
+	if (r)
+	{
+	    llvm::Value* low = builder.CreateIntCast(r->Low(), i64Ty, isSigned, "low");
+	    llvm::Value* high = builder.CreateIntCast(r->High(), i64Ty, isSigned, "high");
+	    in = builder.CreateAnd(builder.CreateICmpSLE(low, x), builder.CreateICmpSLE(x, high), "inrange");
+	}
+	else
+	{
+	    in = builder.CreateICmpEQ(x, builder.CreateIntCast(v->CodeGen(), i64Ty, isSigned), "iselem");
+	}
+	res = builder.CreateOr(res, in);
+    }
+
+    if (constants.empty())
+    {
+	return res;
+    }
+
+    int64_t first = constants[0].first;
+    int64_t last = constants[0].second;
+    for (auto c : constants)
+    {
+	first = std::min(first, c.first);
+	last = std::max(last, c.second);
+    }
+    if (static_cast<uint64_t>(last - first) < 64)
+    {
+	uint64_t bits = 0;
+	for (auto c : constants)
+	{
+	    for (int64_t i = c.first; i <= c.second; i++)
+	    {
+		bits |= 1ULL << (i - first);
+	    }
+	}
+	llvm::Value* offset = builder.CreateSub(x, llvm::ConstantInt::get(i64Ty, first));
+	llvm::Value* inRange = builder.CreateICmpULE(offset, llvm::ConstantInt::get(i64Ty, last - first));
+	llvm::Value* bit = builder.CreateLShr(llvm::ConstantInt::get(i64Ty, bits), offset);
+	bit = builder.CreateTrunc(bit, Types::Get<Types::BoolDecl>()->LlvmType());
+	// The shift is poison when x is outside, so select rather than and.
+	return builder.CreateOr(res, builder.CreateSelect(inRange, bit, MakeBooleanConstant(0)), "inset");
+    }
+
+    for (auto c : constants)
+    {
+	llvm::Value* offset = builder.CreateSub(x, llvm::ConstantInt::get(i64Ty, c.first));
+	llvm::Value* in = builder.CreateICmpULE(offset, llvm::ConstantInt::get(i64Ty, c.second - c.first));
+	res = builder.CreateOr(res, in);
+    }
+    return res;
+}
+
 llvm::Value* BinaryExprAST::SetCodeGen()
 {
     TRACE();
     if (lhs->Type() && IsIntegral(lhs->Type()) && oper.GetToken() == Token::In)
     {
+	if (auto set = llvm::dyn_cast<SetExprAST>(rhs))
+	{
+	    return InSetLiteral(lhs, set);
+	}
+
 	llvm::Value*     l = lhs->CodeGen();
 	llvm::Value*     setV = MakeAddressable(rhs);
 	Types::TypeDecl* type = rhs->Type();
@@ -1408,6 +1861,16 @@ llvm::Value* BinaryExprAST::CodeGen()
 
     ICE_IF(!lhs->Type() || !rhs->Type(), "Huh? Both sides of expression should have type");
 
+    if (llvm::isa<Types::LongStringDecl>(lhs->Type()) || llvm::isa<Types::LongStringDecl>(rhs->Type()))
+    {
+	if (oper.GetToken() == Token::Plus)
+	{
+	    return CallStrCat(lhs, rhs);
+	}
+	llvm::Value* res = CallLongStrFunc("Compare", lhs, rhs, Types::Get<Types::IntegerDecl>());
+	return MakeStrCompare(oper.GetToken(), res);
+    }
+
     if (BothStringish(lhs, rhs))
     {
 	if (oper.GetToken() == Token::Plus)
@@ -1605,6 +2068,11 @@ static std::vector<llvm::Value*> CreateArgList(const std::vector<ExprAST*>& args
 		    v = i->CodeGen();
 		    ICE_IF(!v, "Expected CodeGen to work");
 		}
+		// The callee releases long strings passed by value.
+		if (llvm::isa<Types::LongStringDecl>(vdef[index].Type()))
+		{
+		    v = LongStringOwned(i);
+		}
 		if (!v)
 		{
 		    if (IsCompound(i->Type()))
@@ -1687,6 +2155,12 @@ static llvm::AttributeList CreateAttrList(const std::vector<VarDef>& args)
     return attrList;
 }
 
+// The hidden first argument of the code of a procedural parameter.
+static VarDef EnvArg()
+{
+    return VarDef("$$env", Types::Get<Types::CharDecl>(), VarDef::Flags::Reference | VarDef::Flags::Closure);
+}
+
 static std::vector<llvm::Type*> CreateArgTypes(const std::vector<VarDef>& args)
 {
     std::vector<llvm::Type*> argTypes;
@@ -1705,6 +2179,58 @@ static std::vector<llvm::Type*> CreateArgTypes(const std::vector<VarDef>& args)
     return argTypes;
 }
 
+// Call each target directly when the object has the vtable of a class that uses it, otherwise
+// through the vtable.
+static llvm::Value* CreateGuardedCall(VirtFunctionAST* virt, Types::TypeDecl* resType,
+                                      const std::vector<llvm::Type*>& argTypes,
+                                      const std::vector<llvm::Value*>& argsV, llvm::AttributeList attrList,
+                                      const char* res)
+{
+    llvm::Function*   fn = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* doneBB = llvm::BasicBlock::Create(theContext, "devirt.done", fn);
+    llvm::Value*      vtable = virt->VTable();
+
+    std::vector<std::pair<llvm::Value*, llvm::BasicBlock*>> results;
+    for (auto& t : virt->Targets())
+    {
+	llvm::Value* match = 0;
+	for (auto vt : t.vtables)
+	{
+	    llvm::Value* eq = builder.CreateICmpEQ(vtable, vt, "isvtable");
+	    match = match ? builder.CreateOr(match, eq) : eq;
+	}
+	llvm::BasicBlock* directBB = llvm::BasicBlock::Create(theContext, "devirt.direct", fn);
+	llvm::BasicBlock* nextBB = llvm::BasicBlock::Create(theContext, "devirt.next", fn);
+	builder.CreateCondBr(match, directBB, nextBB);
+	builder.SetInsertPoint(directBB);
+	llvm::CallInst* inst = builder.CreateCall(GetFunction(resType, argTypes, t.fn), argsV, res);
+	inst->setAttributes(attrList);
+	results.push_back({ inst, builder.GetInsertBlock() });
+	builder.CreateBr(doneBB);
+	builder.SetInsertPoint(nextBB);
+    }
+
+    llvm::Type*     ptrTy = llvm::PointerType::getUnqual(theContext);
+    llvm::Value*    calleF = builder.CreateLoad(ptrTy, virt->Entry(vtable), "mfunc");
+    llvm::CallInst* inst = builder.CreateCall(GetFunction(resType, argTypes, calleF), argsV, res);
+    inst->setAttributes(attrList);
+    results.push_back({ inst, builder.GetInsertBlock() });
+    builder.CreateBr(doneBB);
+
+    builder.SetInsertPoint(doneBB);
+    guardedCalls++;
+    if (llvm::isa<Types::VoidDecl>(resType))
+    {
+	return inst;
+    }
+    llvm::PHINode* phi = builder.CreatePHI(inst->getType(), results.size(), "calltmp");
+    for (auto r : results)
+    {
+	phi->addIncoming(r.first, r.second);
+    }
+    return phi;
+}
+
 llvm::Value* CallExprAST::CodeGen()
 {
     TRACE();
@@ -1712,15 +2238,28 @@ llvm::Value* CallExprAST::CodeGen()
 
     BasicDebugInfo(this);
 
-    llvm::Value* calleF = callee->CodeGen();
-    ICE_IF(!calleF, "Expected function to generate some code");
+    // A virtual call with a few possible targets only loads from the vtable when no guard matches.
+    llvm::Value* calleF = 0;
+    auto         virt = llvm::dyn_cast<VirtFunctionAST>(callee);
+    if (!virt || virt->Targets().size() <= 1)
+    {
+	calleF = callee->CodeGen();
+	ICE_IF(!calleF, "Expected function to generate some code");
+    }
 
-    const std::vector<VarDef>& vdef = proto->Args();
+    std::vector<VarDef> vdef = proto->Args();
     ICE_IF(vdef.size() != args.size(), "Incorrect number of arguments for function");
 
-    std::vector<llvm::Type*>  argTypes = CreateArgTypes(vdef);
     std::vector<llvm::Value*> argsV = CreateArgList(args, vdef);
-    llvm::AttributeList       attrList = CreateAttrList(vdef);
+    auto                      fp = llvm::dyn_cast<Types::FuncPtrDecl>(callee->Type());
+    if (fp && fp->IsClosure() && !llvm::isa<FunctionExprAST>(callee))
+    {
+	argsV.insert(argsV.begin(), builder.CreateExtractValue(calleF, Types::FuncPtrDecl::Env, "env"));
+	vdef.insert(vdef.begin(), EnvArg());
+	calleF = builder.CreateExtractValue(calleF, Types::FuncPtrDecl::Code, "code");
+    }
+    std::vector<llvm::Type*> argTypes = CreateArgTypes(vdef);
+    llvm::AttributeList      attrList = CreateAttrList(vdef);
 
     const char*      res = "";
     Types::TypeDecl* resType = proto->Type();
@@ -1728,6 +2267,10 @@ llvm::Value* CallExprAST::CodeGen()
     {
 	res = "calltmp";
     }
+    if (!calleF)
+    {
+	return CreateGuardedCall(virt, resType, argTypes, argsV, attrList, res);
+    }
     llvm::FunctionCallee f = GetFunction(resType, argTypes, calleF);
     llvm::CallInst*      inst = builder.CreateCall(f, argsV, res);
     inst->setAttributes(attrList);
@@ -1861,12 +2404,39 @@ llvm::Function* PrototypeAST::Create(const std::string& namePrefix)
 	    actualName += baseobj->Name() + "$";
 	}
 	actualName += name;
+	// Interface functions of separately compiled units are visible outside the object.
+	if (isExternal)
+	{
+	    linkage = llvm::GlobalValue::ExternalLinkage;
+	}
     }
 
     llvmFunc = CreateFunction(actualName, args, type);
     if (llvmFunc)
     {
 	llvmFunc->setLinkage(linkage);
+	if (attributes & Inline)
+	{
+	    llvmFunc->addFnAttr(llvm::Attribute::AlwaysInline);
+	}
+	if (attributes & NoInline)
+	{
+	    llvmFunc->addFnAttr(llvm::Attribute::NoInline);
+	}
+	// Hot functions are also worth inlining, cold ones are kept small.
+	if (attributes & Hot)
+	{
+	    llvmFunc->addFnAttr(llvm::Attribute::Hot);
+	    if (!(attributes & NoInline))
+	    {
+		llvmFunc->addFnAttr(llvm::Attribute::InlineHint);
+	    }
+	}
+	if (attributes & Cold)
+	{
+	    llvmFunc->addFnAttr(llvm::Attribute::Cold);
+	    llvmFunc->addFnAttr(llvm::Attribute::OptimizeForSize);
+	}
     }
     return llvmFunc;
 }
@@ -1889,8 +2459,15 @@ void PrototypeAST::CreateArgumentAlloca()
 	{
 	    const Types::FieldDecl* f = rd->GetElement(i);
 	    llvm::Type*             ty = f->LlvmType();
-	    llvm::Value*            a = builder.CreateGEP(ty, &*ai, MakeIntegerConstant(i), f->Name());
+	    llvm::Value*            a = builder.CreateStructGEP(rd->LlvmType(), &*ai, i, f->Name());
 	    a = builder.CreateLoad(ty, a, f->Name());
+	    // A copy in a local of our own, which can live in a register.
+	    if (Function()->IsCapturedByValue(f->Name()))
+	    {
+		llvm::Value* v = a;
+		a = CreateNamedAlloca(llvmFunc, f->SubType(), f->Name());
+		builder.CreateStore(v, a);
+	    }
 	    if (!variables.Add(f->Name(), a))
 	    {
 		Error(this, "Duplicate variable name " + f->Name());
@@ -1963,6 +2540,10 @@ void PrototypeAST::CreateArgumentAlloca()
     if (!llvm::isa<Types::VoidDecl>(type))
     {
 	llvm::AllocaInst* a = CreateAlloca(llvmFunc, VarDef(resname, type));
+	if (llvm::isa<Types::LongStringDecl>(type))
+	{
+	    builder.CreateStore(llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(theContext)), a);
+	}
 	if (!variables.Add(resname, a))
 	{
 	    Error(this, "Duplicate function result name '" + resname + "'.");
@@ -2105,6 +2686,7 @@ static llvm::DISubroutineType* CreateFunctionType(DebugInfo& di, PrototypeAST* p
 llvm::Function* FunctionAST::CodeGen(const std::string& namePrefix)
 {
     TRACE();
+    TIME_TRACE_SCOPE("CodeGen", proto->Name());
     VarStackWrapper w(variables);
     LabelWrapper    l(labels);
     ICE_IF(namePrefix.empty(), "Prefix should not be empty");
@@ -2173,6 +2755,32 @@ llvm::Function* FunctionAST::CodeGen(const std::string& namePrefix)
 	DebugInfo& di = GetDebugInfo();
 	di.EmitLocation(endLoc);
     }
+    // Long string locals and value arguments are released on the way out. The result is handed over.
+    std::vector<std::string> lstrVars;
+    for (auto& a : proto->Args())
+    {
+	if (!a.IsRef() && llvm::isa<Types::LongStringDecl>(a.Type()))
+	{
+	    lstrVars.push_back(a.Name());
+	}
+    }
+    for (auto d : varDecls)
+    {
+	for (auto& var : d->Vars())
+	{
+	    if (llvm::isa<Types::LongStringDecl>(var.Type()))
+	    {
+		lstrVars.push_back(var.Name());
+	    }
+	}
+    }
+    for (auto& name : lstrVars)
+    {
+	llvm::Value* v = variables.Find(name);
+	ICE_IF(!v, "Expect long string variable to exist");
+	ReleaseLongString(builder.CreateLoad(llvm::PointerType::getUnqual(theContext), v, name));
+    }
+
     if (llvm::isa<Types::VoidDecl>(proto->Type()))
     {
 	builder.CreateRetVoid();
@@ -2187,6 +2795,23 @@ llvm::Function* FunctionAST::CodeGen(const std::string& namePrefix)
 	builder.CreateRet(retVal);
     }
 
+    // Inline every call made directly from a "flatten" function, unless the callee is noinline.
+    if (proto->HasAttribute(PrototypeAST::Flatten))
+    {
+	for (auto& bb : *theFunction)
+	{
+	    for (auto& inst : bb)
+	    {
+		auto            call = llvm::dyn_cast<llvm::CallInst>(&inst);
+		llvm::Function* callee = call ? call->getCalledFunction() : 0;
+		if (callee && !callee->isIntrinsic() && !callee->hasFnAttribute(llvm::Attribute::NoInline))
+		{
+		    call->addFnAttr(llvm::Attribute::AlwaysInline);
+		}
+	    }
+	}
+    }
+
     if (debugInfo)
     {
 	DebugInfo& di = GetDebugInfo();
@@ -2222,7 +2847,11 @@ Types::TypeDecl* FunctionAST::ClosureType()
 	std::vector<Types::FieldDecl*> vf;
 	for (auto u : usedVariables)
 	{
-	    Types::TypeDecl* ty = new Types::PointerDecl(u.Type());
+	    Types::TypeDecl* ty = u.Type();
+	    if (!IsCapturedByValue(u.Name()))
+	    {
+		ty = new Types::PointerDecl(ty);
+	    }
 	    vf.push_back(new Types::FieldDecl(u.Name(), ty, false));
 	}
 	closureType = new Types::RecordDecl(vf, 0);
@@ -2264,29 +2893,115 @@ void AssignExprAST::DoDump() const
 llvm::Value* AssignExprAST::AssignStr()
 {
     TRACE();
-    auto lhsv = llvm::dyn_cast<AddressableAST>(lhs);
-    ICE_IF(!lhsv, "Expect variable in lhs");
-    ICE_IF(!llvm::isa<Types::StringDecl>(lhsv->Type()), "Expect string type in lhsv->Type()");
+    auto lhsv = llvm::dyn_cast<AddressableAST>(lhs);
+    ICE_IF(!lhsv, "Expect variable in lhs");
+    ICE_IF(!llvm::isa<Types::StringDecl>(lhsv->Type()), "Expect string type in lhsv->Type()");
+
+    if (auto srhs = llvm::dyn_cast<StringExprAST>(rhs))
+    {
+	llvm::Value* dest = lhsv->Address();
+	return TempStringFromStringExpr(dest, srhs);
+    }
+
+    ExprAST* src = rhs;
+    if (auto tc = llvm::dyn_cast<TypeCastAST>(rhs))
+    {
+	src = tc->Expr();
+    }
+    if (llvm::isa<Types::LongStringDecl>(src->Type()))
+    {
+	int capacity = llvm::cast<Types::StringDecl>(lhsv->Type())->Capacity();
+	return LongStringToShort(lhsv->Address(), src, capacity);
+    }
+
+    ICE_IF(!llvm::isa<Types::StringDecl>(rhs->Type()), "Expect string for rhs expression");
+    return CallStrFunc("Assign", lhs, rhs, Types::Get<Types::VoidDecl>(), "");
+}
+
+// Append e to the long string at dest, which is cheaper than building a new string, as the block
+// usually has room to grow in place.
+static llvm::Value* AppendLongString(llvm::Value* dest, ExprAST* e)
+{
+    if (auto tc = llvm::dyn_cast<TypeCastAST>(e))
+    {
+	e = tc->Expr();
+    }
+    Types::TypeDecl* voidTy = Types::Get<Types::VoidDecl>();
+    if (llvm::isa<Types::CharDecl>(e->Type()))
+    {
+	return CallLongStr("AppendChar", voidTy, { dest, e->CodeGen() });
+    }
+    if (!llvm::isa<Types::LongStringDecl>(e->Type()) && !llvm::isa<StringExprAST>(e))
+    {
+	return CallLongStr("AppendStr", voidTy, { dest, MakeStringFromExpr(e, e->Type()) });
+    }
+    bool         owned;
+    llvm::Value* v = LongStringValue(e, owned);
+    llvm::Value* res = CallLongStr("Append", voidTy, { dest, v });
+    if (owned)
+    {
+	ReleaseLongString(v);
+    }
+    return res;
+}
+
+llvm::Value* AssignExprAST::AssignLongStr()
+{
+    TRACE();
+    auto         lhsv = llvm::cast<AddressableAST>(lhs);
+    llvm::Value* dest = lhsv->Address();
 
-    if (auto srhs = llvm::dyn_cast<StringExprAST>(rhs))
+    // "s := s + x" appends to s.
+    auto b = llvm::dyn_cast<BinaryExprAST>(rhs);
+    if (auto tc = llvm::dyn_cast<TypeCastAST>(rhs))
     {
-	llvm::Value* dest = lhsv->Address();
-	return TempStringFromStringExpr(dest, srhs);
+	b = llvm::dyn_cast<BinaryExprAST>(tc->Expr());
+    }
+    if (b && b->Oper().GetToken() == Token::Plus)
+    {
+	auto lve = llvm::dyn_cast<VariableExprAST>(lhs);
+	auto bve = llvm::dyn_cast<VariableExprAST>(b->Lhs());
+	if (lve && bve && llvm::isa<Types::LongStringDecl>(bve->Type()) && lve->Name() == bve->Name())
+	{
+	    return AppendLongString(dest, b->Rhs());
+	}
     }
 
-    ICE_IF(!llvm::isa<Types::StringDecl>(rhs->Type()), "Expect string for rhs expression");
-    return CallStrFunc("Assign", lhs, rhs, Types::Get<Types::VoidDecl>(), "");
+    bool         owned;
+    llvm::Value* v = LongStringValue(rhs, owned);
+    return CallLongStr(owned ? "Move" : "Assign", Types::Get<Types::VoidDecl>(), { dest, v });
+}
+
+// Sets too large to be operated on as values are copied in memory, as an aggregate load and store of
+// thousands of words is very slow to optimise and to generate code for.
+static void StoreSet(llvm::Value* v, llvm::Value* dest, Types::SetDecl* ty)
+{
+    llvm::Align align(sizeof(Types::SetDecl::ElemType));
+    auto        load = llvm::dyn_cast<llvm::LoadInst>(v);
+    if (load && load->use_empty() && ty->SetWords() > Types::SetDecl::MaxInlineWords)
+    {
+	builder.CreateMemCpy(dest, align, load->getPointerOperand(), align, ty->Size());
+	load->eraseFromParent();
+	return;
+    }
+    builder.CreateAlignedStore(v, dest, align);
 }
 
 llvm::Value* AssignExprAST::AssignSet()
 {
-    llvm::Value* v = rhs->CodeGen();
+    // Store the result of an operation on small sets directly, rather than through a temporary.
+    auto         b = llvm::dyn_cast<BinaryExprAST>(rhs);
+    llvm::Value* v = b ? b->SetValue() : 0;
+    if (!v)
+    {
+	v = rhs->CodeGen();
+    }
     auto         lhsv = llvm::dyn_cast<AddressableAST>(lhs);
     llvm::Value* dest = lhsv->Address();
     ICE_IF(*lhs->Type() != *rhs->Type(), "Types should match?");
     ICE_IF(!dest, "Expected address from lhsv!");
-    builder.CreateStore(v, dest);
-    return v;
+    StoreSet(v, dest, llvm::cast<Types::SetDecl>(lhs->Type()));
+    return dest;
 }
 
 llvm::Value* AssignExprAST::CodeGen()
@@ -2303,6 +3018,11 @@ llvm::Value* AssignExprAST::CodeGen()
 	return AssignStr();
     }
 
+    if (llvm::isa<Types::LongStringDecl>(lhsv->Type()))
+    {
+	return AssignLongStr();
+    }
+
     if (llvm::isa<Types::SetDecl>(lhsv->Type()))
     {
 	return AssignSet();
@@ -2491,14 +3211,14 @@ llvm::Value* GenForInSet(ForExprAST* expr, Types::SetDecl* sd)
 
     llvm::PHINode* idxPhi = builder.CreatePHI(index->getType(), 2, "idxPhi");
     idxPhi->addIncoming(index, beforeBB);
-    llvm::Type*  intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
-    llvm::Value* bitsetAddr = builder.CreateGEP(intTy, setV, idxPhi, "valueindex");
-    llvm::Value* bitset = builder.CreateLoad(intTy, bitsetAddr);
-
     llvm::Value* cmp = builder.CreateICmpSLT(idxPhi, words);
     builder.CreateCondBr(cmp, preLoopBB, afterBB);
 
+    // Only load the word once we know it is inside the set.
     builder.SetInsertPoint(preLoopBB);
+    llvm::Type*          intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    llvm::Value*         bitsetAddr = builder.CreateGEP(intTy, setV, idxPhi, "valueindex");
+    llvm::Value*         bitset = builder.CreateLoad(intTy, bitsetAddr);
     llvm::FunctionCallee cttz = GetFunction(intTy, { intTy, Types::Get<Types::BoolDecl>()->LlvmType() },
                                             "llvm.cttz.i32");
     llvm::Value*         isZero = builder.CreateICmpEQ(bitset, zero);
@@ -2519,7 +3239,7 @@ llvm::Value* GenForInSet(ForExprAST* expr, Types::SetDecl* sd)
 
     bitset = builder.CreateAnd(phi, builder.CreateNot(builder.CreateShl(one, pos)));
     isZero = builder.CreateICmpEQ(bitset, zero);
-    phi->addIncoming(bitset, loopBB);
+    phi->addIncoming(bitset, builder.GetInsertBlock());
     builder.CreateCondBr(isZero, nextLoopBB, loopBB);
 
     builder.SetInsertPoint(nextLoopBB);
@@ -2890,6 +3610,12 @@ static llvm::FunctionCallee CreateWriteFunc(Types::TypeDecl* ty, llvm::Type* fty
 	argTypes.push_back(intTy);
 	suffix = "str";
     }
+    else if (llvm::isa<Types::LongStringDecl>(ty))
+    {
+	argTypes.push_back(ty->LlvmType());
+	argTypes.push_back(intTy);
+	suffix = "lstr";
+    }
     else if (IsCharArray(ty))
     {
 	llvm::Type* pty = llvm::PointerType::getUnqual(theContext);
@@ -2915,7 +3641,12 @@ static llvm::FunctionCallee CreateWriteFunc(Types::TypeDecl* ty, llvm::Type* fty
 
 static llvm::Value* MakeEnumToString(Types::EnumDecl* etype)
 {
-    const std::string     e2sName = "enum2str_" + std::to_string(etype->UniqueId());
+    // The table only depends on the names, so enums with the same names can share it.
+    std::string e2sName = "enum2str";
+    for (auto v : etype->Values())
+    {
+	e2sName += "." + v.name;
+    }
     llvm::GlobalVariable* gv = theModule->getGlobalVariable(e2sName, true);
 
     if (gv)
@@ -2982,6 +3713,7 @@ llvm::Value* WriteAST::CodeGen()
     {
 	std::vector<llvm::Value*> argsV;
 	llvm::FunctionCallee      fn;
+	llvm::Value*              ownedStr = 0;
 	argsV.push_back(dst);
 	if (isText)
 	{
@@ -2994,6 +3726,12 @@ llvm::Value* WriteAST::CodeGen()
 	    {
 		v = builder.CreateGEP(charTy, MakeAddressable(arg.expr), MakeIntegerConstant(0), "str_addr");
 	    }
+	    else if (llvm::isa<Types::LongStringDecl>(type))
+	    {
+		bool owned;
+		v = LongStringValue(arg.expr, owned);
+		ownedStr = owned ? v : 0;
+	    }
 	    else if (Types::IsCharArray(type))
 	    {
 		if (llvm::isa<StringExprAST, BuiltinExprAST>(arg.expr))
@@ -3070,6 +3808,10 @@ llvm::Value* WriteAST::CodeGen()
 	    fn = GetFunction(Types::Get<Types::VoidDecl>()->LlvmType(), { dstTy, voidPtrTy }, "__write_bin");
 	}
 	v = builder.CreateCall(fn, argsV, "");
+	if (ownedStr)
+	{
+	    ReleaseLongString(ownedStr);
+	}
     }
     if (kind == WriteKind::WriteLn)
     {
@@ -3144,6 +3886,10 @@ static llvm::FunctionCallee CreateReadFunc(Types::TypeDecl* ty, llvm::Type* fty,
     {
 	suffix = "str";
     }
+    else if (llvm::isa<Types::LongStringDecl>(ty))
+    {
+	suffix = "lstr";
+    }
     else if (IsCharArray(ty))
     {
 	suffix = "chars";
@@ -3246,6 +3992,16 @@ llvm::Value* VarDeclAST::CodeGenGlobal(VarDef var)
     }
 
     ICE_IF(!ty, "Type should have a value");
+    // Defined in another object file, so just declare it, unless it's already here.
+    if (var.IsImported())
+    {
+	if (llvm::GlobalVariable* gv = theModule->getGlobalVariable(var.Name()))
+	{
+	    return gv;
+	}
+	return new llvm::GlobalVariable(*theModule, ty, false, llvm::GlobalValue::ExternalLinkage, nullptr,
+	                                var.Name());
+    }
     llvm::Constant*   init;
     llvm::Constant*   nullValue = llvm::Constant::getNullValue(ty);
     Types::ClassDecl* cd = llvm::dyn_cast<Types::ClassDecl>(var.Type());
@@ -3275,9 +4031,8 @@ llvm::Value* VarDeclAST::CodeGenGlobal(VarDef var)
     llvm::GlobalValue::LinkageTypes linkage = (var.IsExternal() ? llvm::GlobalValue::ExternalLinkage
                                                                 : llvm::Function::InternalLinkage);
 
-    llvm::GlobalVariable*  gv = new llvm::GlobalVariable(*theModule, ty, false, linkage, init, var.Name());
-    const llvm::DataLayout& dl = theModule->getDataLayout();
-    size_t                 al = std::max(size_t(4), dl.getPrefTypeAlign(ty).value());
+    llvm::GlobalVariable* gv = new llvm::GlobalVariable(*theModule, ty, false, linkage, init, var.Name());
+    size_t                al = std::max(size_t(4), AlignOfType(ty));
     gv->setAlignment(llvm::Align(al));
     v = gv;
     if (debugInfo)
@@ -3314,6 +4069,10 @@ llvm::Value* VarDeclAST::CodeGenLocal(VarDef var)
 	llvm::Value*          dest = builder.CreateGEP(ty, v, MakeIntegerConstant(0), "vtable");
 	builder.CreateStore(gv, dest);
     }
+    else if (llvm::isa<Types::LongStringDecl>(var.Type()))
+    {
+	builder.CreateStore(llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(theContext)), v);
+    }
     else if (ExprAST* iv = var.Init())
     {
 	llvm::Value* init = iv->CodeGen();
@@ -3346,6 +4105,16 @@ llvm::Value* VarDeclAST::CodeGenLocal(VarDef var)
     return v;
 }
 
+void VarDeclAST::AddFlags(VarDef::Flags f)
+{
+    for (auto& v : vars)
+    {
+	ExprAST* init = v.Init();
+	v = VarDef(v.Name(), v.Type(), v.GetFlags() | f);
+	v.SetInit(init);
+    }
+}
+
 llvm::Value* VarDeclAST::CodeGen()
 {
     TRACE();
@@ -3585,12 +4354,11 @@ void SetExprAST::DoDump() const
     std::cerr << "]";
 }
 
-llvm::Constant* SetExprAST::MakeConstantSetArray()
+std::vector<Types::SetDecl::ElemType> SetExprAST::ConstantSetWords(const std::vector<ExprAST*>& elems)
 {
-    llvm::Type* ty = type->LlvmType();
-
-    Types::SetDecl::ElemType elems[Types::SetDecl::MaxSetWords] = {};
-    for (auto v : values)
+    size_t                                size = llvm::dyn_cast<Types::SetDecl>(type)->SetWords();
+    std::vector<Types::SetDecl::ElemType> words(size);
+    for (auto v : elems)
     {
 	if (auto r = llvm::dyn_cast<RangeExprAST>(v))
 	{
@@ -3600,10 +4368,10 @@ llvm::Constant* SetExprAST::MakeConstantSetArray()
 	    int  low = le->Int() - start;
 	    int  high = he->Int() - start;
 	    low = std::max(0, low);
-	    high = std::min((int)type->GetRange()->Size(), high);
+	    high = std::min((int)type->GetRange()->Size() - 1, high);
 	    for (int i = low; i <= high; i++)
 	    {
-		elems[i >> Types::SetDecl::SetPow2Bits] |= (1 << (i & Types::SetDecl::SetMask));
+		words[i >> Types::SetDecl::SetPow2Bits] |= (1 << (i & Types::SetDecl::SetMask));
 	    }
 	}
 	else
@@ -3613,33 +4381,38 @@ llvm::Constant* SetExprAST::MakeConstantSetArray()
 	    unsigned i = e->Int() - start;
 	    if (i < (unsigned)type->GetRange()->Size())
 	    {
-		elems[i >> Types::SetDecl::SetPow2Bits] |= (1 << (i & Types::SetDecl::SetMask));
+		words[i >> Types::SetDecl::SetPow2Bits] |= (1 << (i & Types::SetDecl::SetMask));
 	    }
 	}
     }
+    return words;
+}
 
-    auto            setType = llvm::dyn_cast<Types::SetDecl>(type);
-    size_t          size = setType->SetWords();
-    llvm::Constant* initArr[Types::SetDecl::MaxSetWords];
-    auto            aty = llvm::dyn_cast<llvm::ArrayType>(ty);
-    llvm::Type*     eltTy = aty->getElementType();
+llvm::Constant* SetExprAST::ConstantSetArray(const std::vector<ExprAST*>& elems)
+{
+    auto        aty = llvm::dyn_cast<llvm::ArrayType>(type->LlvmType());
+    llvm::Type* eltTy = aty->getElementType();
 
-    for (size_t i = 0; i < size; i++)
+    std::vector<llvm::Constant*> initArr;
+    for (auto w : ConstantSetWords(elems))
     {
-	initArr[i] = llvm::ConstantInt::get(eltTy, elems[i]);
+	initArr.push_back(llvm::ConstantInt::get(eltTy, w));
     }
+    return llvm::ConstantArray::get(aty, initArr);
+}
 
-    llvm::Constant* init = llvm::ConstantArray::get(aty, llvm::ArrayRef<llvm::Constant*>(initArr, size));
-    return init;
+llvm::Constant* SetExprAST::MakeConstantSetArray()
+{
+    return ConstantSetArray(values);
 }
 
-llvm::Value* SetExprAST::MakeConstantSet()
+llvm::Value* SetExprAST::MakeConstantSet(const std::vector<ExprAST*>& elems)
 {
     static int  index = 1;
     llvm::Type* ty = type->LlvmType();
     ICE_IF(!ty, "Expect type for set to work");
 
-    llvm::Constant* init = MakeConstantSetArray();
+    llvm::Constant* init = ConstantSetArray(elems);
 
     llvm::GlobalValue::LinkageTypes linkage = llvm::Function::InternalLinkage;
     std::string                     name("P" + std::to_string(index) + ".set");
@@ -3647,137 +4420,189 @@ llvm::Value* SetExprAST::MakeConstantSet()
     return gv;
 }
 
-llvm::Value* SetExprAST::Address()
+// The low and high values of a range, or the value of an element, relative to the start of the set.
+static void ElementBounds(ExprAST* v, Types::TypeDecl* type, llvm::Value*& low, llvm::Value*& high)
 {
-    TRACE();
+    llvm::Type*  intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    llvm::Value* rangeStart = MakeIntegerConstant(type->GetRange()->Start());
+    if (auto r = llvm::dyn_cast<RangeExprAST>(v))
+    {
+	low = r->Low();
+	high = r->High();
+	ICE_IF(!high || !low, "Expected expressions to evalueate");
+	low = builder.CreateSub(builder.CreateSExt(low, intTy, "sext.low"), rangeStart);
+	high = builder.CreateSub(builder.CreateSExt(high, intTy, "sext.high"), rangeStart);
+    }
+    else
+    {
+	llvm::Value* x = v->CodeGen();
+	ICE_IF(!x, "Expect codegen to work!");
+	low = high = builder.CreateSub(builder.CreateZExt(x, intTy, "zext"), rangeStart);
+    }
+}
 
-    ICE_IF(!type, "No type supplied");
+// Build a set that fits in a vector of words in a register. Each element or range is turned into a
+// mask for every word, and or-ed in, so the set is stored once.
+static llvm::Value* MakeSetValue(llvm::Value* setV, size_t words, const std::vector<ExprAST*>& elems,
+                                 Types::TypeDecl* type, llvm::ArrayRef<Types::SetDecl::ElemType> init)
+{
+    llvm::Type*  intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    auto         vecTy = llvm::FixedVectorType::get(intTy, words);
+    llvm::Value* zero = llvm::Constant::getNullValue(vecTy);
+    llvm::Value* ones = llvm::Constant::getAllOnesValue(vecTy);
+    llvm::Value* maxBit = llvm::ConstantInt::get(vecTy, Types::SetDecl::SetMask);
 
-    ICE_IF(type->GetRange()->Size() > Types::SetDecl::MaxSetSize, "Size too large?");
+    std::vector<Types::SetDecl::ElemType> base;
+    std::vector<Types::SetDecl::ElemType> lanes;
+    for (size_t i = 0; i < words; i++)
+    {
+	base.push_back(i * Types::SetDecl::SetBits);
+	lanes.push_back(i);
+    }
+    llvm::Value* baseV = llvm::ConstantDataVector::get(theContext, base);
+    llvm::Value* lanesV = llvm::ConstantDataVector::get(theContext, lanes);
 
-    // Check if ALL the values involved are constants.
-    bool allConstants = true;
-    for (auto v : values)
+    llvm::Value* set = llvm::ConstantDataVector::get(theContext, init);
+    for (auto v : elems)
     {
-	if (auto r = llvm::dyn_cast<RangeExprAST>(v))
+	llvm::Value* low;
+	llvm::Value* high;
+	ElementBounds(v, type, low, high);
+	llvm::Value* mask;
+	if (llvm::isa<RangeExprAST>(v))
 	{
-	    if (!IsConstant(r->HighExpr()) || !IsConstant(r->LowExpr()))
-	    {
-		allConstants = false;
-		break;
-	    }
+	    // The bits of the range in each word, clamped to the word. Words where the first bit
+	    // comes after the last are outside the range.
+	    llvm::Value* lastElem = MakeIntegerConstant(type->GetRange()->Size() - 1);
+	    high = builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, high, lastElem);
+	    llvm::Value* first = builder.CreateSub(builder.CreateVectorSplat(words, low), baseV);
+	    llvm::Value* last = builder.CreateSub(builder.CreateVectorSplat(words, high), baseV);
+	    first = builder.CreateBinaryIntrinsic(llvm::Intrinsic::smax, first, zero);
+	    last = builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, last, maxBit);
+	    mask = builder.CreateAnd(builder.CreateShl(ones, first),
+	                             builder.CreateLShr(ones, builder.CreateSub(maxBit, last)));
+	    mask = builder.CreateSelect(builder.CreateICmpSLE(first, last), mask, zero, "rangemask");
 	}
 	else
 	{
-	    if (!IsConstant(v))
-	    {
-		allConstants = false;
-		break;
-	    }
+	    llvm::Value* index = builder.CreateLShr(low, MakeIntegerConstant(Types::SetDecl::SetPow2Bits));
+	    llvm::Value* offset = builder.CreateAnd(low, MakeIntegerConstant(Types::SetDecl::SetMask));
+	    llvm::Value* bit = builder.CreateShl(MakeIntegerConstant(1), offset);
+	    llvm::Value* isWord = builder.CreateICmpEQ(lanesV, builder.CreateVectorSplat(words, index));
+	    mask = builder.CreateSelect(isWord, builder.CreateVectorSplat(words, bit), zero, "bitmask");
 	}
+	set = builder.CreateOr(set, mask);
     }
+    builder.CreateAlignedStore(set, setV, llvm::Align(sizeof(Types::SetDecl::ElemType)));
+    return setV;
+}
 
-    if (allConstants)
-    {
-	return MakeConstantSet();
-    }
-
-    llvm::Value* setV = CreateTempAlloca(type);
-
-    llvm::Value* tmp = builder.CreateBitCast(setV, Types::GetVoidPtrType());
-
-    size_t size = llvm::dyn_cast<Types::SetDecl>(type)->SetWords();
-    builder.CreateMemSet(tmp, MakeConstant(0, Types::Get<Types::CharDecl>()),
-                         (size * Types::SetDecl::SetBits / 8), llvm::Align(1));
-
-    llvm::Type* intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+static void OrWord(llvm::Value* setV, llvm::Value* index, llvm::Value* mask)
+{
+    llvm::Type*  intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    llvm::Value* addr = builder.CreateGEP(intTy, setV, index, "bitsetaddr");
+    llvm::Value* word = builder.CreateLoad(intTy, addr, "bitset");
+    builder.CreateStore(builder.CreateOr(word, mask), addr);
+}
 
-    // TODO: For optimisation, we may want to pass through the vector and see if the values
-    // are constants, and if so, be clever about it.
-    // Also, we should combine stores to the same word!
-    for (auto v : values)
-    {
-	// If we have a "range", then make a loop.
-	if (auto r = llvm::dyn_cast<RangeExprAST>(v))
-	{
-	    llvm::Value* low = r->Low();
-	    llvm::Value* high = r->High();
-	    ICE_IF(!high || !low, "Expected expressions to evalueate");
+// Add a range to a set in memory: the first and last words get a mask of the bits in the range,
+// and the words between them are filled with a memset.
+static void AddRangeToSet(llvm::Value* setV, size_t size, llvm::Value* low, llvm::Value* high)
+{
+    llvm::Function*   fn = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* rangeBB = llvm::BasicBlock::Create(theContext, "range", fn);
+    llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(theContext, "afterrange", fn);
 
-	    llvm::Function* fn = builder.GetInsertBlock()->getParent();
+    low = builder.CreateBinaryIntrinsic(llvm::Intrinsic::smax, low, MakeIntegerConstant(0));
+    high = builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, high, MakeIntegerConstant(size - 1));
+    builder.CreateCondBr(builder.CreateICmpSLE(low, high), rangeBB, afterBB);
 
-	    llvm::Value* loopVar = CreateTempAlloca(Types::Get<Types::IntegerDecl>());
+    builder.SetInsertPoint(rangeBB);
+    llvm::Value* shift = MakeIntegerConstant(Types::SetDecl::SetPow2Bits);
+    llvm::Value* bitMask = MakeIntegerConstant(Types::SetDecl::SetMask);
+    llvm::Value* ones = MakeIntegerConstant(-1);
+    llvm::Value* lowWord = builder.CreateLShr(low, shift);
+    llvm::Value* highWord = builder.CreateLShr(high, shift);
+    llvm::Value* lowMask = builder.CreateShl(ones, builder.CreateAnd(low, bitMask));
+    llvm::Value* highBit = builder.CreateAnd(high, bitMask);
+    llvm::Value* highMask = builder.CreateLShr(ones, builder.CreateSub(bitMask, highBit));
+    llvm::Value* same = builder.CreateICmpEQ(lowWord, highWord);
+    OrWord(setV, lowWord, builder.CreateAnd(lowMask, builder.CreateSelect(same, highMask, ones)));
+    OrWord(setV, highWord, builder.CreateAnd(highMask, builder.CreateSelect(same, lowMask, ones)));
 
-	    // Adjust for range:
-	    Types::Range* range = type->GetRange();
-	    low = builder.CreateSExt(low, intTy, "sext.low");
-	    high = builder.CreateSExt(high, intTy, "sext.high");
+    llvm::Type*  intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
+    llvm::Value* one = MakeIntegerConstant(1);
+    llvm::Value* between = builder.CreateSub(builder.CreateSub(highWord, lowWord), one);
+    between = builder.CreateSelect(same, MakeIntegerConstant(0), between);
+    llvm::Value* fillAddr = builder.CreateGEP(intTy, setV, builder.CreateAdd(lowWord, one), "fill");
+    llvm::Value* fillSize = builder.CreateShl(between, MakeIntegerConstant(2));
+    builder.CreateMemSet(fillAddr, MakeConstant(0xff, Types::Get<Types::CharDecl>()), fillSize,
+                         llvm::Align(sizeof(Types::SetDecl::ElemType)));
+    builder.CreateBr(afterBB);
 
-	    llvm::Value* rangeStart = MakeIntegerConstant(range->Start());
-	    low = builder.CreateSub(low, rangeStart);
-	    high = builder.CreateSub(high, rangeStart);
+    builder.SetInsertPoint(afterBB);
+}
 
-	    builder.CreateStore(low, loopVar);
+llvm::Value* SetExprAST::Address()
+{
+    TRACE();
 
-	    llvm::BasicBlock* loopBB = llvm::BasicBlock::Create(theContext, "loop", fn);
-	    builder.CreateBr(loopBB);
-	    builder.SetInsertPoint(loopBB);
+    ICE_IF(!type, "No type supplied");
 
-	    llvm::Value* loop = builder.CreateLoad(intTy, loopVar, "loopVar");
+    // The elements known at compile time are folded into one constant set, and the others are
+    // or-ed into it.
+    std::vector<ExprAST*> constants;
+    std::vector<ExprAST*> dynamic;
+    for (auto v : values)
+    {
+	if (IsConstantElement(v))
+	{
+	    constants.push_back(v);
+	}
+	else
+	{
+	    dynamic.push_back(v);
+	}
+    }
 
-	    // Set bit "loop" in set.
-	    llvm::Value* mask = MakeIntegerConstant(Types::SetDecl::SetMask);
-	    llvm::Value* offset = builder.CreateAnd(loop, mask);
-	    llvm::Value* bit = builder.CreateShl(MakeIntegerConstant(1), offset);
-	    llvm::Value* index = 0;
-	    if (size != 1)
-	    {
-		index = builder.CreateLShr(loop, MakeIntegerConstant(Types::SetDecl::SetPow2Bits));
-	    }
-	    else
-	    {
-		index = MakeIntegerConstant(0);
-	    }
-	    llvm::Value* bitsetAddr = builder.CreateGEP(intTy, setV, index, "bitsetaddr");
-	    llvm::Value* bitset = builder.CreateLoad(intTy, bitsetAddr, "bitset");
-	    bitset = builder.CreateOr(bitset, bit);
-	    builder.CreateStore(bitset, bitsetAddr);
+    if (dynamic.empty())
+    {
+	return MakeConstantSet(values);
+    }
 
-	    loop = builder.CreateAdd(loop, MakeIntegerConstant(1), "update");
-	    builder.CreateStore(loop, loopVar);
+    llvm::Value* setV = CreateTempAlloca(type);
+    size_t       words = llvm::dyn_cast<Types::SetDecl>(type)->SetWords();
 
-	    llvm::Value* endCond = builder.CreateICmpSLE(loop, high, "loopcond");
+    if (SetValueType(type))
+    {
+	return MakeSetValue(setV, words, dynamic, type, ConstantSetWords(constants));
+    }
 
-	    llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(theContext, "afterloop", fn);
-	    builder.CreateCondBr(endCond, loopBB, afterBB);
+    size_t bytes = words * Types::SetDecl::SetBits / 8;
+    if (constants.empty())
+    {
+	builder.CreateMemSet(setV, MakeConstant(0, Types::Get<Types::CharDecl>()), bytes, llvm::Align(1));
+    }
+    else
+    {
+	builder.CreateMemCpy(setV, llvm::Align(1), MakeConstantSet(constants), llvm::Align(1), bytes);
+    }
 
-	    builder.SetInsertPoint(afterBB);
+    size_t size = type->GetRange()->Size();
+    for (auto v : dynamic)
+    {
+	llvm::Value* low;
+	llvm::Value* high;
+	ElementBounds(v, type, low, high);
+	if (llvm::isa<RangeExprAST>(v))
+	{
+	    AddRangeToSet(setV, size, low, high);
 	}
 	else
 	{
-	    Types::Range* range = type->GetRange();
-	    llvm::Value*  rangeStart = MakeIntegerConstant(range->Start());
-	    llvm::Value*  x = v->CodeGen();
-	    ICE_IF(!x, "Expect codegen to work!");
-	    x = builder.CreateZExt(x, intTy, "zext");
-	    x = builder.CreateSub(x, rangeStart);
-
-	    llvm::Value* mask = MakeIntegerConstant(Types::SetDecl::SetMask);
-	    llvm::Value* offset = builder.CreateAnd(x, mask);
-	    llvm::Value* bit = builder.CreateShl(MakeIntegerConstant(1), offset);
-	    llvm::Value* index = 0;
-	    if (size != 1)
-	    {
-		index = builder.CreateLShr(x, MakeIntegerConstant(Types::SetDecl::SetPow2Bits));
-	    }
-	    else
-	    {
-		index = MakeIntegerConstant(0);
-	    }
-	    llvm::Value* bitsetAddr = builder.CreateGEP(intTy, setV, index, "bitsetaddr");
-	    llvm::Value* bitset = builder.CreateLoad(intTy, bitsetAddr, "bitset");
-	    bitset = builder.CreateOr(bitset, bit);
-	    builder.CreateStore(bitset, bitsetAddr);
+	    llvm::Value* index = builder.CreateLShr(low, MakeIntegerConstant(Types::SetDecl::SetPow2Bits));
+	    llvm::Value* offset = builder.CreateAnd(low, MakeIntegerConstant(Types::SetDecl::SetMask));
+	    OrWord(setV, index, builder.CreateShl(MakeIntegerConstant(1), offset));
 	}
     }
 
@@ -3942,6 +4767,18 @@ static llvm::Value* ConvertSet(ExprAST* expr, Types::TypeDecl* type)
     size_t       p = 0;
     llvm::Type*  intTy = Types::Get<Types::IntegerDecl>()->LlvmType();
 
+    if (lty->SetWords() > Types::SetDecl::MaxInlineWords || rty->SetWords() > Types::SetDecl::MaxInlineWords)
+    {
+	llvm::Type*          pty = llvm::PointerType::getUnqual(theContext);
+	llvm::FunctionCallee f = GetFunction(Types::Get<Types::VoidDecl>()->LlvmType(),
+	                                     { pty, intTy, intTy, pty, intTy, intTy }, "__SetConvert");
+	llvm::Value*         lStart = MakeIntegerConstant(lrange->Start());
+	llvm::Value*         rStart = MakeIntegerConstant(rrange->Start());
+	builder.CreateCall(f, { dest, lStart, MakeIntegerConstant(lty->SetWords()), src, rStart,
+	                        MakeIntegerConstant(rty->SetWords()) });
+	return dest;
+    }
+
     for (auto i = lrange->Start(); i < lrange->End(); i += Types::SetDecl::SetBits)
     {
 	if (i >= (rrange->Start() & ~Types::SetDecl::SetMask) && i < rrange->End())
@@ -4009,7 +4846,12 @@ llvm::Value* TypeCastAST::CodeGen()
     {
 	return builder.CreateBitCast(expr->CodeGen(), type->LlvmType());
     }
-    if ((Types::IsCharArray(current) || llvm::isa<Types::CharDecl>(current)) &&
+    if (llvm::isa<Types::LongStringDecl>(type))
+    {
+	return LongStringOwned(expr);
+    }
+    if ((Types::IsCharArray(current) || llvm::isa<Types::CharDecl>(current) ||
+         llvm::isa<Types::LongStringDecl>(current)) &&
         llvm::isa<Types::StringDecl>(type))
     {
 	return MakeStringFromExpr(expr, type);
@@ -4192,7 +5034,7 @@ void VTableAST::Fixup()
 }
 
 VirtFunctionAST::VirtFunctionAST(const Location& w, ExprAST* slf, int idx, Types::TypeDecl* ty)
-    : AddressableAST(w, EK_VirtFunction, ty), index(idx), self(slf)
+    : AddressableAST(w, EK_VirtFunction, ty), index(idx), self(slf), analysed(false)
 {
     ICE_IF(index < 0, "Index should not be negative!");
 }
@@ -4202,17 +5044,100 @@ void VirtFunctionAST::DoDump() const
     std::cerr << "VirtFunctionAST: " << std::endl;
 }
 
+llvm::Value* VirtFunctionAST::CodeGen()
+{
+    if (Targets().size() == 1)
+    {
+	devirtualisedCalls++;
+	return targets[0].fn;
+    }
+    return AddressableAST::CodeGen();
+}
+
 llvm::Value* VirtFunctionAST::Address()
+{
+    return Entry(VTable());
+}
+
+llvm::Value* VirtFunctionAST::VTable()
 {
     llvm::Value* v = MakeAddressable(self);
     llvm::Type*  ty = self->Type()->LlvmType();
-    auto         vtableTy = llvm::dyn_cast<Types::ClassDecl>(self->Type())->VTableType(Types::FilledIn);
     llvm::Type*  ptrVTableTy = llvm::PointerType::getUnqual(theContext);
     llvm::Value* zero = MakeIntegerConstant(0);
     v = builder.CreateGEP(ty, v, { zero, zero }, "vptr");
-    v = builder.CreateLoad(ptrVTableTy, v, "vtable");
-    v = builder.CreateGEP(vtableTy, v, { zero, MakeIntegerConstant(index) }, "mfunc");
-    return v;
+    return builder.CreateLoad(ptrVTableTy, v, "vtable");
+}
+
+llvm::Value* VirtFunctionAST::Entry(llvm::Value* vtable)
+{
+    auto         vtableTy = llvm::dyn_cast<Types::ClassDecl>(self->Type())->VTableType(Types::FilledIn);
+    llvm::Value* zero = MakeIntegerConstant(0);
+    return builder.CreateGEP(vtableTy, vtable, { zero, MakeIntegerConstant(index) }, "mfunc");
+}
+
+static Types::MemberFuncDecl* VirtualMember(const Types::ClassDecl* cd, int index)
+{
+    for (size_t i = 0; i < cd->MembFuncCount(); i++)
+    {
+	Types::MemberFuncDecl* mf = cd->GetMembFunc(i);
+	if ((mf->IsVirtual() || mf->IsOverride()) && mf->VirtIndex() == index)
+	{
+	    return mf;
+	}
+    }
+    return nullptr;
+}
+
+// Class hierarchy analysis: the implementations of the function in the static class of self and
+// in every class derived from it. Empty when that is not known, as when a unit is compiled on its
+// own and the program may derive more classes, or when there are too many to check for.
+const std::vector<VirtTarget>& VirtFunctionAST::Targets()
+{
+    const size_t maxGuardedVTables = 4;
+
+    if (analysed)
+    {
+	return targets;
+    }
+    analysed = true;
+    if (!wholeProgram || compileUnit)
+    {
+	return targets;
+    }
+
+    auto                           cd = llvm::cast<Types::ClassDecl>(self->Type());
+    std::vector<Types::ClassDecl*> classes = { cd };
+    classes.insert(classes.end(), cd->Derived().begin(), cd->Derived().end());
+    for (auto c : classes)
+    {
+	llvm::GlobalVariable*  vtable = theModule->getGlobalVariable("vtable_" + c->Name(), true);
+	Types::MemberFuncDecl* mf = VirtualMember(c, index);
+	if (!vtable || !mf)
+	{
+	    targets.clear();
+	    return targets;
+	}
+	llvm::Function* fn = mf->Proto()->Create("P");
+	auto            t = targets.begin();
+	while (t != targets.end() && t->fn != fn)
+	{
+	    t++;
+	}
+	if (t == targets.end())
+	{
+	    targets.push_back({ fn, { vtable } });
+	}
+	else
+	{
+	    t->vtables.push_back(vtable);
+	}
+    }
+    if (targets.size() > 1 && classes.size() > maxGuardedVTables)
+    {
+	targets.clear();
+    }
+    return targets;
 }
 
 void GotoAST::DoDump() const
@@ -4296,6 +5221,33 @@ llvm::Value* UnitAST::CodeGen()
     return NoOpValue();
 }
 
+std::vector<std::string> UnitAST::InitNames() const
+{
+    std::vector<std::string> names;
+    for (auto c : code)
+    {
+	if (auto u = llvm::dyn_cast<UnitAST>(c))
+	{
+	    std::vector<std::string> sub = u->InitNames();
+	    names.insert(names.end(), sub.begin(), sub.end());
+	}
+    }
+    if (initFunc && initFunc->Proto()->Name() != "__PascalMain")
+    {
+	names.push_back(initFunc->Proto()->Name());
+    }
+    return names;
+}
+
+ClosureAST::ClosureAST(const Location& w, FunctionAST* fn)
+    : ExprAST(w, EK_Closure, fn->ClosureType()), func(fn)
+{
+    for (auto u : fn->UsedVars())
+    {
+	content.push_back(new VariableExprAST(fn->Loc(), u.Name(), u.Type()));
+    }
+}
+
 void ClosureAST::DoDump() const
 {
     std::cerr << "Closure ";
@@ -4315,8 +5267,8 @@ llvm::Value* ClosureAST::CodeGen()
     int             index = 0;
     for (auto u : content)
     {
-	llvm::Value* v = u->Address();
-	llvm::Value* ptr = builder.CreateGEP(v->getType(), closure, MakeIntegerConstant(index), u->Name());
+	llvm::Value* v = func->IsCapturedByValue(u->Name()) ? u->CodeGen() : u->Address();
+	llvm::Value* ptr = builder.CreateStructGEP(type->LlvmType(), closure, index, u->Name());
 	builder.CreateStore(v, ptr);
 	index++;
     }
@@ -4359,6 +5311,83 @@ void TrampolineAST::accept(ASTVisitor& v)
     v.visit(this);
 }
 
+void FuncPtrAST::DoDump() const
+{
+    std::cerr << "Function pointer for ";
+    func->DoDump();
+}
+
+// Code for a procedure without a closure passed as a procedural parameter. The environment is the
+// procedure itself, which is called with the remaining arguments. One thunk serves every procedure
+// with the same signature.
+static llvm::Function* GetFuncPtrThunk(const PrototypeAST* proto)
+{
+    // Records and strings passed by value are all pointers in the function type, so the thunks
+    // are told apart by the byval types in the attributes as well.
+    using ThunkKey = std::pair<llvm::FunctionType*, void*>;
+    static std::map<ThunkKey, llvm::Function*> thunks;
+
+    std::vector<VarDef> args = proto->Args();
+    llvm::Type*         resTy = proto->Type()->LlvmType();
+    llvm::FunctionType* fnTy = llvm::FunctionType::get(resTy, CreateArgTypes(args), false);
+    llvm::AttributeList attrList = CreateAttrList(args);
+    ThunkKey            key{ fnTy, attrList.getRawPointer() };
+    if (auto it = thunks.find(key); it != thunks.end() && it->second->getParent() == theModule)
+    {
+	return it->second;
+    }
+
+    args.insert(args.begin(), EnvArg());
+    llvm::Function* thunk = CreateFunction("$$thunk." + std::to_string(thunks.size()), args, proto->Type());
+    thunk->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+    // A builder of its own, as the thunk has no debug info.
+    llvm::IRBuilder<>         bld(llvm::BasicBlock::Create(theContext, "entry", thunk));
+    std::vector<llvm::Value*> callArgs;
+    for (auto arg = thunk->arg_begin() + 1; arg != thunk->arg_end(); arg++)
+    {
+	callArgs.push_back(arg);
+    }
+    llvm::CallInst* call = bld.CreateCall(fnTy, thunk->getArg(0), callArgs);
+    call->setAttributes(attrList);
+    if (resTy->isVoidTy())
+    {
+	bld.CreateRetVoid();
+    }
+    else
+    {
+	bld.CreateRet(call);
+    }
+    thunks[key] = thunk;
+    return thunk;
+}
+
+llvm::Value* FuncPtrAST::CodeGen()
+{
+    TRACE();
+
+    llvm::Value* fn = func->CodeGen();
+    llvm::Value* code = fn;
+    llvm::Value* env = fn;
+    if (closure)
+    {
+	env = closure->CodeGen();
+    }
+    else
+    {
+	code = GetFuncPtrThunk(func->Proto());
+    }
+    llvm::Value* fp = llvm::PoisonValue::get(Type()->LlvmType());
+    fp = builder.CreateInsertValue(fp, code, Types::FuncPtrDecl::Code);
+    return builder.CreateInsertValue(fp, env, Types::FuncPtrDecl::Env, "funcptr");
+}
+
+void FuncPtrAST::accept(ASTVisitor& v)
+{
+    func->accept(v);
+    v.visit(this);
+}
+
 static llvm::Constant* MakeCharArray(Types::TypeDecl* type, const ExprAST* value)
 {
     std::string val;
@@ -4588,18 +5617,21 @@ void ArraySliceAST::accept(ASTVisitor& v)
 
 static void BuildUnitInitList()
 {
-    std::vector<llvm::Constant*> unitList(unitInit.size() + 1);
+    std::vector<llvm::Constant*> unitList;
     llvm::Type*                  vp = Types::GetVoidPtrType();
-    int                          index = 0;
+    std::set<llvm::Function*>    seen;
     for (auto v : unitInit)
     {
 	llvm::Function* fn = theModule->getFunction("P." + v->Proto()->Name());
 	ICE_IF(!fn, "Expected to find the function!");
-	unitList[index] = llvm::ConstantExpr::getBitCast(fn, vp);
-	index++;
+	// A separately compiled unit may be imported by more than one other unit.
+	if (seen.insert(fn).second)
+	{
+	    unitList.push_back(llvm::ConstantExpr::getBitCast(fn, vp));
+	}
     }
-    unitList[unitInit.size()] = llvm::Constant::getNullValue(vp);
-    llvm::ArrayType*              arr = llvm::ArrayType::get(vp, unitInit.size() + 1);
+    unitList.push_back(llvm::Constant::getNullValue(vp));
+    llvm::ArrayType*              arr = llvm::ArrayType::get(vp, unitList.size());
     llvm::Constant*               init = llvm::ConstantArray::get(arr, unitList);
     [[maybe_unused]] llvm::Value* unitInitList = new llvm::GlobalVariable(
         *theModule, arr, true, llvm::GlobalValue::ExternalLinkage, init, "UnitIniList");
@@ -4612,5 +5644,14 @@ void BackPatch()
     {
 	v->Fixup();
     }
-    BuildUnitInitList();
+    // The program using the unit builds the list.
+    if (!compileUnit)
+    {
+	BuildUnitInitList();
+    }
+    if (verbosity)
+    {
+	std::cerr << "Devirtualised calls: " << devirtualisedCalls << " direct, " << guardedCalls
+	          << " guarded" << std::endl;
+    }
 }
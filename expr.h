@@ -1,6 +1,7 @@
 #ifndef EXPR_H
 #define EXPR_H
 
+#include "arena.h"
 #include "builtin.h"
 #include "namedobject.h"
 #include "stack.h"
@@ -84,6 +85,7 @@ public:
 	EK_FunctionExpr,
 	EK_TypeCastExpr,
 	EK_ArraySlice,
+	EK_LongStringIndex,
 	EK_LastAddressable,
 
 	EK_CallExpr,
@@ -114,6 +116,7 @@ public:
 	EK_Unit,
 	EK_Closure,
 	EK_Trampoline,
+	EK_FuncPtr,
 
 	EK_InitValue,
 	EK_InitArray,
@@ -121,6 +124,12 @@ public:
     };
     ExprAST(const Location& w, ExprKind k, Types::TypeDecl* ty = 0) : loc(w), kind(k), type(ty) {}
     virtual ~ExprAST() {}
+    // AST nodes live in the arena of the compilation, and are never deleted one by one.
+    static void*         operator new(size_t size)
+    {
+	return Arena::Allocate(size, Arena::AST, Arena::Destroy<ExprAST>);
+    }
+    static void          operator delete(void*) {}
     void                 dump() const;
     virtual void         DoDump() const = 0;
     void                 accept(ASTVisitor& v) override { v.visit(this); }
@@ -240,11 +249,16 @@ public:
         : AddressableAST(w, EK_SetExpr, ty), values(v)
     {
     }
-    void            DoDump() const override;
-    llvm::Value*    Address() override;
-    llvm::Constant* MakeConstantSetArray();
-    llvm::Value*    MakeConstantSet();
-    static bool     classof(const ExprAST* e) { return e->getKind() == EK_SetExpr; }
+    void                         DoDump() const override;
+    llvm::Value*                 Address() override;
+    llvm::Constant*              MakeConstantSetArray();
+    const std::vector<ExprAST*>& Values() const { return values; }
+    static bool                  classof(const ExprAST* e) { return e->getKind() == EK_SetExpr; }
+
+private:
+    std::vector<Types::SetDecl::ElemType> ConstantSetWords(const std::vector<ExprAST*>& elems);
+    llvm::Constant*                       ConstantSetArray(const std::vector<ExprAST*>& elems);
+    llvm::Value*                          MakeConstantSet(const std::vector<ExprAST*>& elems);
 
 private:
     std::vector<ExprAST*> values;
@@ -254,11 +268,11 @@ class VariableExprAST : public AddressableAST
 {
 public:
     VariableExprAST(const Location& w, const std::string& nm, Types::TypeDecl* ty)
-        : AddressableAST(w, EK_VariableExpr, ty), name(nm), flags(VarDef::Flags::None)
+        : AddressableAST(w, EK_VariableExpr, ty), name(nm), ident(Intern(nm)), flags(VarDef::Flags::None)
     {
     }
     VariableExprAST(const Location& w, const NamedObject* obj)
-        : AddressableAST{ w, EK_VariableExpr, obj->Type() }, name{ obj->Name() }
+        : AddressableAST{ w, EK_VariableExpr, obj->Type() }, name{ obj->Name() }, ident{ Intern(name) }
     {
 	if (auto vd = llvm::dyn_cast<VarDef>(obj))
 	{
@@ -272,7 +286,8 @@ public:
     bool              IsProtected() { return (flags & VarDef::Flags::Protected) == VarDef::Flags::Protected; }
 
 protected:
-    std::string name;
+    std::string   name;
+    Ident         ident;
     VarDef::Flags flags;
 };
 
@@ -314,6 +329,33 @@ private:
     Types::DynRangeDecl* range;
 };
 
+// A character of a long string. Reading it leaves the string shared, while taking its address, to
+// change it, first gives the variable a copy of its own if the block is shared.
+class LongStringIndexAST : public AddressableAST
+{
+    friend class TypeCheckVisitor;
+
+public:
+    LongStringIndexAST(const Location& w, ExprAST* v, ExprAST* idx)
+        : AddressableAST(w, EK_LongStringIndex, Types::Get<Types::CharDecl>()), expr(v), index(idx)
+    {
+    }
+    void         DoDump() const override;
+    llvm::Value* CodeGen() override;
+    llvm::Value* Address() override;
+    static bool  classof(const ExprAST* e) { return e->getKind() == EK_LongStringIndex; }
+    void         accept(ASTVisitor& v) override
+    {
+	index->accept(v);
+	expr->accept(v);
+	v.visit(this);
+    }
+
+private:
+    ExprAST* expr;
+    ExprAST* index;
+};
+
 class PointerExprAST : public AddressableAST
 {
 public:
@@ -394,6 +436,11 @@ public:
     static bool      classof(const ExprAST* e) { return e->getKind() == EK_BinaryExpr; }
     Types::TypeDecl* Type() const override;
     void             UpdateType(Types::TypeDecl* ty);
+    // The result of a set operation as a value of SetValueType, or 0 if it isn't one.
+    llvm::Value*     SetValue();
+    const Token&     Oper() const { return oper; }
+    ExprAST*         Lhs() { return lhs; }
+    ExprAST*         Rhs() { return rhs; }
     void             accept(ASTVisitor& v) override
     {
 	rhs->accept(v);
@@ -489,6 +536,7 @@ public:
     void         DoDump() const override;
     llvm::Value* CodeGen() override;
     static bool  classof(const ExprAST* e) { return e->getKind() == EK_AssignExpr; }
+    ExprAST*     Lhs() { return lhs; }
     void         accept(ASTVisitor& v) override
     {
 	lhs->accept(v);
@@ -498,6 +546,7 @@ public:
 
 private:
     llvm::Value* AssignStr();
+    llvm::Value* AssignLongStr();
     llvm::Value* AssignSet();
     ExprAST*     lhs;
     ExprAST*     rhs;
@@ -515,6 +564,7 @@ public:
     FunctionAST*               Function() { return func; }
     static bool                classof(const ExprAST* e) { return e->getKind() == EK_VarDecl; }
     const std::vector<VarDef>& Vars() { return vars; }
+    void                       AddFlags(VarDef::Flags f);
 
 private:
     llvm::Value* CodeGenGlobal(VarDef var);
@@ -529,6 +579,16 @@ class PrototypeAST : public ExprAST
     friend class TypeCheckVisitor;
 
 public:
+    // Directives given after the heading, steering the inliner and code placement.
+    enum Attributes
+    {
+	Inline = 1 << 0,
+	NoInline = 1 << 1,
+	Hot = 1 << 2,
+	Cold = 1 << 3,
+	Flatten = 1 << 4,
+    };
+
     PrototypeAST(const Location& w, const std::string& nm, const std::vector<VarDef>& ar,
                  Types::TypeDecl* resTy, const std::string& resNm, Types::ClassDecl* obj)
         : ExprAST(w, EK_Prototype, resTy)
@@ -539,6 +599,8 @@ public:
         , baseobj(obj)
         , isForward(false)
         , hasSelf(false)
+        , isExternal(false)
+        , attributes(0)
         , llvmFunc(0)
     {
 	ICE_IF(!resTy, "Type must not be null!");
@@ -552,8 +614,12 @@ public:
     const std::vector<VarDef>& Args() const { return args; }
     bool                       IsForward() const { return isForward; }
     bool                       HasSelf() const { return hasSelf; }
+    bool                       IsExternal() const { return isExternal; }
     void                       SetIsForward(bool v);
     void                       SetHasSelf(bool v) { hasSelf = v; }
+    void                       SetIsExternal(bool v) { isExternal = v; }
+    void                       AddAttribute(Attributes a) { attributes |= a; }
+    bool                       HasAttribute(Attributes a) const { return (attributes & a) != 0; }
     void                       SetFunction(FunctionAST* fun) { function = fun; }
     FunctionAST*               Function() const { return function; }
     void                       AddExtraArgsFirst(const std::vector<VarDef>& extra);
@@ -571,6 +637,8 @@ private:
     Types::ClassDecl*   baseobj;
     bool                isForward;
     bool                hasSelf;
+    bool                isExternal;
+    unsigned            attributes;
     llvm::Function*     llvmFunc;
 };
 
@@ -589,6 +657,9 @@ public:
     const std::vector<FunctionAST*> SubFunctions() const { return subFunctions; }
     void                    SetUsedVars(const std::set<VarDef>& usedvars) { usedVariables = usedvars; }
     const std::set<VarDef>& UsedVars() { return usedVariables; }
+    // Captured variables that nothing writes while we run, so the closure holds a copy.
+    void                    SetValueCaptures(const std::set<std::string>& names) { valueCaptures = names; }
+    bool                    IsCapturedByValue(const std::string& nm) const { return valueCaptures.count(nm); }
     Types::TypeDecl*        ClosureType();
     const std::string       ClosureName() { return "$$CLOSURE"; };
     static bool             classof(const ExprAST* e) { return e->getKind() == EK_Function; }
@@ -601,6 +672,7 @@ private:
     BlockAST*                 body;
     std::vector<FunctionAST*> subFunctions;
     std::set<VarDef>          usedVariables;
+    std::set<std::string>     valueCaptures;
     FunctionAST*              parent;
     Types::TypeDecl*          closureType;
     Location                  endLoc;
@@ -657,10 +729,11 @@ public:
         : ExprAST(w, EK_BuiltinExpr, b->Type()), bif(b)
     {
     }
-    void         DoDump() const override;
-    llvm::Value* CodeGen() override;
-    static bool  classof(const ExprAST* e) { return e->getKind() == EK_BuiltinExpr; }
-    void         accept(ASTVisitor& v) override;
+    void                         DoDump() const override;
+    llvm::Value*                 CodeGen() override;
+    static bool                  classof(const ExprAST* e) { return e->getKind() == EK_BuiltinExpr; }
+    const std::vector<ExprAST*>& Args() const { return bif->Args(); }
+    void                         accept(ASTVisitor& v) override;
 
 private:
     Builtin::FunctionBase* bif;
@@ -701,10 +774,11 @@ public:
         : ExprAST(w, EK_ForExpr), variable(v), start(s), stepDown(false), end(nullptr), body(b)
     {
     }
-    void         DoDump() const override;
-    llvm::Value* CodeGen() override;
-    static bool  classof(const ExprAST* e) { return e->getKind() == EK_ForExpr; }
-    void         accept(ASTVisitor& v) override;
+    void             DoDump() const override;
+    llvm::Value*     CodeGen() override;
+    static bool      classof(const ExprAST* e) { return e->getKind() == EK_ForExpr; }
+    VariableExprAST* Variable() { return variable; }
+    void             accept(ASTVisitor& v) override;
 
 private:
     llvm::Value* ForInGen();
@@ -802,10 +876,11 @@ public:
         : ExprAST(w, EK_Read), src(sc), args(a), kind(knd)
     {
     }
-    void         DoDump() const override;
-    llvm::Value* CodeGen() override;
-    static bool  classof(const ExprAST* e) { return e->getKind() == EK_Read; }
-    void         accept(ASTVisitor& v) override;
+    void                         DoDump() const override;
+    llvm::Value*                 CodeGen() override;
+    static bool                  classof(const ExprAST* e) { return e->getKind() == EK_Read; }
+    const std::vector<ExprAST*>& Args() const { return args; }
+    void                         accept(ASTVisitor& v) override;
 
 private:
     AddressableAST*       src;
@@ -961,19 +1036,32 @@ private:
     llvm::GlobalVariable* vtable;
 };
 
+// A member function that a virtual call may reach, and the vtables of the classes that use it.
+struct VirtTarget
+{
+    llvm::Function*                    fn;
+    std::vector<llvm::GlobalVariable*> vtables;
+};
+
 class VirtFunctionAST : public AddressableAST
 {
 public:
     VirtFunctionAST(const Location& w, ExprAST* slf, int idx, Types::TypeDecl* ty);
-    void         DoDump() const override;
-    llvm::Value* Address() override;
-    int          Index() const { return index; }
-    ExprAST*     Self() { return self; }
-    static bool  classof(const ExprAST* e) { return e->getKind() == EK_VirtFunction; }
+    void                           DoDump() const override;
+    llvm::Value*                   CodeGen() override;
+    llvm::Value*                   Address() override;
+    llvm::Value*                   VTable();
+    llvm::Value*                   Entry(llvm::Value* vtable);
+    const std::vector<VirtTarget>& Targets();
+    int                            Index() const { return index; }
+    ExprAST*                       Self() { return self; }
+    static bool                    classof(const ExprAST* e) { return e->getKind() == EK_VirtFunction; }
 
 private:
-    int      index;
-    ExprAST* self;
+    int                     index;
+    ExprAST*                self;
+    bool                    analysed;
+    std::vector<VirtTarget> targets;
 };
 
 class GotoAST : public ExprAST
@@ -998,25 +1086,28 @@ public:
     static bool          classof(const ExprAST* e) { return e->getKind() == EK_Unit; }
     void                 accept(ASTVisitor& v) override;
     const InterfaceList& Interface() { return interfaceList; }
+    // Source form of the interface, used to write the interface file of a separately compiled unit.
+    const std::string&       InterfaceText() const { return interfaceText; }
+    void                     SetInterfaceText(const std::string& text) { interfaceText = text; }
+    std::vector<std::string> InitNames() const;
 
 private:
     FunctionAST*          initFunc;
     std::vector<ExprAST*> code;
     InterfaceList         interfaceList;
+    std::string           interfaceText;
 };
 
 class ClosureAST : public ExprAST
 {
 public:
-    ClosureAST(const Location& w, Types::TypeDecl* ty, const std::vector<VariableExprAST*>& vf)
-        : ExprAST(w, EK_Closure, ty), content(vf)
-    {
-    }
+    ClosureAST(const Location& w, FunctionAST* fn);
     void         DoDump() const override;
     llvm::Value* CodeGen() override;
     static bool  classof(const ExprAST* e) { return e->getKind() == EK_Closure; }
 
 private:
+    FunctionAST*                  func;
     std::vector<VariableExprAST*> content;
 };
 
@@ -1038,6 +1129,26 @@ private:
     Types::FuncPtrDecl* funcPtrTy;
 };
 
+// A procedure passed as a procedural parameter, as a {code, env} pair. A nested procedure is the code
+// itself, with its closure as the environment. Other procedures are the environment of a thunk that
+// calls them with the remaining arguments.
+class FuncPtrAST : public ExprAST
+{
+public:
+    FuncPtrAST(const Location& w, FunctionExprAST* fn, ClosureAST* c, Types::FuncPtrDecl* fnPtrTy)
+        : ExprAST(w, EK_FuncPtr, fnPtrTy), func(fn), closure(c)
+    {
+    }
+    void         DoDump() const override;
+    llvm::Value* CodeGen() override;
+    static bool  classof(const ExprAST* e) { return e->getKind() == EK_FuncPtr; }
+    void         accept(ASTVisitor& v) override;
+
+private:
+    FunctionExprAST* func;
+    ClosureAST*      closure;
+};
+
 class InitValueAST : public ExprAST
 {
 public:
@@ -1136,5 +1247,13 @@ llvm::AllocaInst*    CreateTempAlloca(Types::TypeDecl* ty);
 llvm::Value*         MakeStrCompare(Token::TokenType oper, llvm::Value* v);
 llvm::Value*         CallStrFunc(const std::string& name, ExprAST* lhs, ExprAST* rhs, Types::TypeDecl* resTy,
                                  const std::string& twine);
+// Small sets are operated on as one integer, or as a vector of words. Returns 0 for other sets.
+llvm::Type*          SetValueType(Types::TypeDecl* ty);
+llvm::Value*         LoadSetValue(ExprAST* e, llvm::Type* ty);
+// A long string value is owned when the caller has to release it, and borrowed from a variable.
+llvm::Value*         LongStringValue(ExprAST* e, bool& owned);
+void                 ReleaseLongString(llvm::Value* v);
+llvm::Value*         CallLongStrFunc(const std::string& name, ExprAST* lhs, ExprAST* rhs,
+                                     Types::TypeDecl* resTy);
 
 #endif
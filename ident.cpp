@@ -0,0 +1,34 @@
+#include "ident.h"
+#include "options.h"
+#include "utils.h"
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+// Elements of an unordered_set don't move when it grows, so the pointers stay valid.
+static std::unordered_set<std::string> names;
+// Units are lexed on several threads at once.
+static std::mutex namesMutex;
+
+Ident Intern(const std::string& name)
+{
+    // Most names are seen many times, so each thread remembers the ones it has looked up, and
+    // only takes the lock for names that are new to it.
+    thread_local std::unordered_map<std::string, Ident> seen;
+    if (auto it = seen.find(name); it != seen.end())
+    {
+	return it->second;
+    }
+    std::string key = name;
+    if (caseInsensitive)
+    {
+	strlower(key);
+    }
+    Ident id;
+    {
+	std::lock_guard<std::mutex> lock(namesMutex);
+	id = &*names.insert(std::move(key)).first;
+    }
+    seen.emplace(name, id);
+    return id;
+}
@@ -0,0 +1,12 @@
+#ifndef IDENT_H
+#define IDENT_H
+
+#include <string>
+
+// Names are interned, so there is a single copy of each, and they can be compared and hashed as
+// pointers. When the language is case insensitive, the interned copy is lowercase.
+using Ident = const std::string*;
+
+Ident Intern(const std::string& name);
+
+#endif
@@ -1,5 +1,7 @@
+#include "arena.h"
 #include "binary.h"
 #include "builtin.h"
+#include "cache.h"
 #include "callgraph.h"
 #include "constants.h"
 #include "lexer.h"
@@ -8,22 +10,39 @@
 #include "semantics.h"
 #include "source.h"
 #include "trace.h"
+#include <chrono>
 #include <iostream>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Analysis/CGSCCPassManager.h>
 #include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Passes/OptimizationLevel.h>
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
 
 #include <llvm/IR/PassManager.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/PGOOptions.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Target/TargetMachine.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
 #include <llvm/Transforms/Utils.h>
+#include <sys/resource.h>
+
+#ifndef LLD_ENABLE
+#define LLD_ENABLE 0
+#endif
 
 std::string   libpath;
+std::string   cacheDir;
+std::string   traceFile;
+std::string   profileUse;
 llvm::Module* theModule;
 
 int      verbosity;
@@ -33,6 +52,17 @@ OptLevel optimization = O1;
 bool     rangeCheck;
 bool     debugInfo;
 bool     callGraph;
+bool     runJit;
+bool     lldLink = LLD_ENABLE;
+bool     keepObject;
+bool     compileUnit;
+bool     wholeProgram = true;
+bool     runtimeBitcode;
+bool     setValues = true;
+bool     profileGenerate;
+unsigned cacheSize = 512;
+unsigned codegenThreads;
+bool     cacheStats;
 Model    model = m64;
 bool     caseInsensitive = true;
 EmitType emitType;
@@ -61,6 +91,11 @@ static llvm::cl::opt<EmitType, true> EmitSelection(
 static llvm::cl::opt<bool, true> TimetraceEnable("tt", llvm::cl::desc("Enable timetrace"),
                                                  llvm::cl::location(timetrace));
 
+static llvm::cl::opt<std::string, true> TraceFile("trace-file",
+                                                  llvm::cl::desc("Write compile time trace as Chrome JSON"),
+                                                  llvm::cl::value_desc("file"),
+                                                  llvm::cl::location(traceFile));
+
 static llvm::cl::opt<bool, true> DisableMemCpy("no-memcpy",
                                                llvm::cl::desc("Disable use of memcpy for larger structs"),
                                                llvm::cl::location(disableMemcpyOpt));
@@ -86,8 +121,64 @@ static llvm::cl::opt<Standard, true> StandardOpt("std", llvm::cl::desc("ISO stan
                                                                   clEnumVal(iso10206, "ISO-10206 mode")),
                                                  llvm::cl::location(standard));
 
-static void RunOptimisationPasses(llvm::Module& theModule)
+static llvm::cl::opt<bool, true> RunOpt("run", llvm::cl::desc("Compile and run the program in-process"),
+                                        llvm::cl::location(runJit));
+
+#if LLD_ENABLE
+static llvm::cl::opt<bool, true> LldLinkOpt("lld", llvm::cl::desc("Link in-process with LLD (default)"),
+                                            llvm::cl::location(lldLink));
+#endif
+
+static llvm::cl::opt<bool, true> KeepObject("keep-obj", llvm::cl::desc("Keep the object file after linking"),
+                                            llvm::cl::location(keepObject));
+
+static llvm::cl::opt<bool, true> CompileUnit("unit",
+                                             llvm::cl::desc("Compile a unit to an object and interface file"),
+                                             llvm::cl::location(compileUnit));
+
+static llvm::cl::opt<bool, true> WholeProgram(
+    "whole-program", llvm::cl::desc("Devirtualise calls using all the classes in the program"),
+    llvm::cl::location(wholeProgram));
+
+static llvm::cl::opt<bool, true> RuntimeBitcode("runtime-bc",
+                                                llvm::cl::desc("Optimise the runtime along with the program"),
+                                                llvm::cl::location(runtimeBitcode));
+
+static llvm::cl::opt<bool, true> SetValues("set-values",
+                                           llvm::cl::desc("Operate on small sets as integers and vectors"),
+                                           llvm::cl::location(setValues));
+
+static llvm::cl::opt<bool, true> ProfileGenerate("fprofile-generate",
+                                                 llvm::cl::desc("Instrument to write <program>.profraw"),
+                                                 llvm::cl::location(profileGenerate));
+
+static llvm::cl::opt<std::string, true> ProfileUse("fprofile-use",
+                                                   llvm::cl::desc("Optimise using an llvm-profdata profile"),
+                                                   llvm::cl::value_desc("file.profdata"),
+                                                   llvm::cl::location(profileUse));
+
+static llvm::cl::opt<unsigned, true> CodegenThreads("j",
+                                                    llvm::cl::desc("Split code generation over N threads"),
+                                                    llvm::cl::value_desc("N"), llvm::cl::Prefix,
+                                                    llvm::cl::location(codegenThreads));
+
+static llvm::cl::opt<std::string, true> CacheDir("cache-dir",
+                                                 llvm::cl::desc("Cache object files in <dir> and reuse them"),
+                                                 llvm::cl::value_desc("dir"), llvm::cl::location(cacheDir));
+
+static llvm::cl::opt<unsigned, true> CacheSize("cache-size",
+                                               llvm::cl::desc("Maximum cache size in MiB (default 512)"),
+                                               llvm::cl::location(cacheSize));
+
+static llvm::cl::opt<bool, true> CacheStats("cache-stats", llvm::cl::desc("Print cache statistics"),
+                                            llvm::cl::location(cacheStats));
+
+static llvm::cl::list<std::string> ProgramArgs(llvm::cl::ConsumeAfter,
+                                               llvm::cl::desc("<program arguments>..."));
+
+static void RunOptimisationPasses(llvm::Module& theModule, const std::string& fileName)
 {
+    TIME_TRACE();
     llvm::OptimizationLevel opt;
     switch (OptimizationLevel)
     {
@@ -109,15 +200,42 @@ static void RunOptimisationPasses(llvm::Module& theModule)
 	break;
     }
 
-    if (opt != llvm::OptimizationLevel::O0)
+    // Profile guided optimisation. The instrumented program writes the raw profile next to the source.
+    std::optional<llvm::PGOOptions> pgo;
+    if (profileGenerate)
     {
-	llvm::PassBuilder pb;
+	llvm::SmallString<128> rawName(fileName);
+	llvm::sys::fs::make_absolute(rawName);
+	llvm::sys::path::replace_extension(rawName, "profraw");
+	pgo = llvm::PGOOptions(rawName.str().str(), "", "", "", llvm::vfs::getRealFileSystem(),
+	                       llvm::PGOOptions::IRInstr);
+    }
+    else if (!profileUse.empty())
+    {
+	pgo = llvm::PGOOptions(profileUse, "", "", "", llvm::vfs::getRealFileSystem(),
+	                       llvm::PGOOptions::IRUse);
+    }
+
+    if (opt != llvm::OptimizationLevel::O0 || pgo)
+    {
+	// Give the passes the real target, so that the cost models (TTI) used by the vectorizers and
+	// inliner match the CPU the code is generated for.
+	llvm::TargetMachine* tm = GetTargetMachine();
 
 	llvm::LoopAnalysisManager     lam;
 	llvm::FunctionAnalysisManager fam;
 	llvm::CGSCCAnalysisManager    cgam;
 	llvm::ModuleAnalysisManager   mam;
 
+	// The standard instrumentation puts the time of each pass in the -trace-file output.
+	llvm::PassInstrumentationCallbacks pic;
+	llvm::StandardInstrumentations     si(theModule.getContext(), false);
+	si.registerCallbacks(pic, &mam);
+	llvm::PassBuilder pb(tm, llvm::PipelineTuningOptions(), pgo, &pic);
+
+	llvm::TargetLibraryInfoImpl tlii(tm->getTargetTriple());
+	fam.registerPass([&] { return llvm::TargetLibraryAnalysis(tlii); });
+
 	pb.registerModuleAnalyses(mam);
 	pb.registerCGSCCAnalyses(cgam);
 	pb.registerFunctionAnalyses(fam);
@@ -132,7 +250,19 @@ static void RunOptimisationPasses(llvm::Module& theModule)
 static int Compile(const std::string& fileName)
 {
     TIME_TRACE();
+    auto start = std::chrono::steady_clock::now();
+    // All AST and type nodes are released in one go when this goes out of scope.
+    Arena arena;
     theModule = CreateModule();
+    // On a cache hit, the object from an earlier compile is linked directly.
+    if (!cacheDir.empty() && EmitSelection == Exe && !compileUnit && !runJit)
+    {
+	std::vector<std::string> objNames;
+	if (CacheLookup(fileName, objNames))
+	{
+	    return LinkObjects(objNames, fileName) ? 0 : 1;
+	}
+    }
     Builtin::InitBuiltins();
     FileSource source(fileName);
     if (!source)
@@ -142,7 +272,7 @@ static int Compile(const std::string& fileName)
     }
     ParserInterface& p = GetParser(source);
 
-    ExprAST* ast = p.Parse(ParserType::Program);
+    ExprAST* ast = p.Parse(compileUnit ? ParserType::Unit : ParserType::Program);
     if (int e = p.GetErrors())
     {
 	std::cerr << "Errors in parsing: " << e << ".\nExiting..." << std::endl;
@@ -173,7 +303,7 @@ static int Compile(const std::string& fileName)
     }
 
     {
-	TIME_TRACE();
+	TIME_TRACE_SCOPE("CodeGen", "");
 	if (!ast->CodeGen())
 	{
 	    std::cerr << "Sorry, something went wrong here..." << std::endl;
@@ -182,6 +312,10 @@ static int Compile(const std::string& fileName)
 	}
 	BackPatch();
     }
+    if (verbosity || timetrace)
+    {
+	arena.PrintStats(std::cerr);
+    }
 
 #if !NDEBUG
     if (verbosity)
@@ -190,11 +324,34 @@ static int Compile(const std::string& fileName)
     }
 #endif
 
-    RunOptimisationPasses(*theModule);
+    // A unit's object is linked with the program, which brings in the runtime.
+    if (runtimeBitcode && !compileUnit && !LinkRuntimeBitcode(theModule))
+    {
+	return 1;
+    }
+
+    RunOptimisationPasses(*theModule, fileName);
+    // The profile runtime writes the profile when the program exits.
+    if (profileGenerate && !compileUnit)
+    {
+	AddLinkObject(libpath + "/libprofile_rt.a");
+    }
+    if (runJit)
+    {
+	std::vector<std::string> args(ProgramArgs.begin(), ProgramArgs.end());
+	return RunModule(theModule, fileName, args, start);
+    }
     if (!CreateBinary(theModule, fileName, EmitSelection))
     {
 	return 1;
     }
+    if (compileUnit && EmitSelection == Exe)
+    {
+	if (!CreateInterface(llvm::cast<UnitAST>(ast), fileName))
+	{
+	    return 1;
+	}
+    }
     return 0;
 }
 
@@ -202,6 +359,36 @@ int main(int argc, char** argv)
 {
     libpath = GetPath(argv[0]);
     llvm::cl::ParseCommandLineOptions(argc, argv);
+    if (!runJit && !ProgramArgs.empty())
+    {
+	std::cerr << "Program arguments are only allowed with --run" << std::endl;
+	return 1;
+    }
+    if (profileGenerate && (runJit || !profileUse.empty()))
+    {
+	std::cerr << "-fprofile-generate can't be used with --run or -fprofile-use" << std::endl;
+	return 1;
+    }
+    if (runJit && compileUnit)
+    {
+	std::cerr << "A unit can't be run" << std::endl;
+	return 1;
+    }
+    TimeTraceInit(argv[0]);
     int res = Compile(InputFilename);
+    if (!TimeTraceWrite() && !res)
+    {
+	res = 1;
+    }
+    if (timetrace)
+    {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	std::cerr << "Peak RSS " << usage.ru_maxrss << " KB" << std::endl;
+    }
+    if (cacheStats && !cacheDir.empty())
+    {
+	CachePrintStats();
+    }
     return res;
 }
@@ -5,43 +5,7 @@
 #include <iostream>
 #include <limits>
 
-Lexer::Lexer(Source& source) : source(source), curValid(0) {}
-
-int Lexer::GetChar()
-{
-    return source.Get();
-}
-
-int Lexer::CurChar()
-{
-    if (!curValid)
-    {
-	NextChar();
-	curValid++;
-    }
-    return curChar;
-}
-
-int Lexer::NextChar()
-{
-    if (curValid > 1)
-    {
-	curValid--;
-	return curChar = nextChar;
-    }
-
-    return curChar = GetChar();
-}
-
-int Lexer::PeekChar()
-{
-    if (curValid > 1)
-    {
-	return nextChar;
-    }
-    curValid++;
-    return nextChar = GetChar();
-}
+Lexer::Lexer(Source& source) : source(source), cur(source.Begin()), end(source.End()), lookahead(0) {}
 
 static Token ConvertFloat(const std::string& num, const Location& w)
 {
@@ -99,7 +63,7 @@ bool ValidForBase(char c, int base)
 Token Lexer::NumberToken()
 {
     int             ch = CurChar();
-    const Location& w = Where();
+    const Location& w = Where(ch == '$');
     std::string     num;
     int             base = 10;
 
@@ -147,6 +111,7 @@ Token Lexer::NumberToken()
 	    ICE_IF(ch != '.', "Fraction should start with '.'");
 	    if (PeekChar() == '.' || PeekChar() == ')')
 	    {
+		lookahead = 1;
 		break;
 	    }
 	    isFloat = true;
@@ -206,24 +171,26 @@ Token Lexer::StringToken()
 {
     std::string     str;
     const Location& w = Where();
-    int             quote = CurChar();
-    int             ch = NextChar();
+    char            quote = *cur;
     for (;;)
     {
-	if (ch == quote)
+	// Copy up to the next quote in one go.
+	const char* start = ++cur;
+	while (cur < end && *cur != quote && *cur != '\n')
 	{
-	    if (PeekChar() != quote)
-	    {
-		break;
-	    }
-	    NextChar();
+	    cur++;
 	}
-	if (ch == '\n' || ch == EOF)
+	str.append(start, cur);
+	if (cur == end || *cur == '\n')
 	{
 	    return Token(Token::UntermString, w);
 	}
-	str += ch;
-	ch = NextChar();
+	if (PeekChar() != quote)
+	{
+	    break;
+	}
+	cur++;
+	str += quote;
     }
     NextChar();
     if (str.size() == 1)
@@ -251,6 +218,7 @@ Token Lexer::GetToken()
 {
     int             ch = CurChar();
     const Location& w = Where();
+    lookahead = 0;
 
     do
     {
@@ -385,14 +353,11 @@ Token Lexer::GetToken()
     // Identifiers start with alpha characters, or underscore.
     if (std::isalpha(ch) || ch == '_')
     {
-	std::string str;
-	// Default to the "most likely".
-	str = static_cast<char>(ch);
 	// Allow alphanumeric and underscore.
+	const char* start = cur;
 	while (std::isalnum(ch = NextChar()) || ch == '_')
-	{
-	    str += static_cast<char>(ch);
-	}
+	    ;
+	std::string      str(start, cur);
 	Token::TokenType tt = Token::KeyWordToToken(str);
 	if (tt != Token::Unknown)
 	{
@@ -4,6 +4,7 @@
 #include "location.h"
 #include "source.h"
 #include "token.h"
+#include <cstdio>
 #include <string>
 
 class Lexer
@@ -14,21 +15,35 @@ public:
     Source& GetSource() { return source; }
 
 private:
-    int NextChar();
-    int CurChar();
-    int PeekChar();
-    int GetChar();
+    // The characters are read straight from the text of the source, with EOF at the end.
+    int CurChar() const { return cur < end ? static_cast<unsigned char>(*cur) : EOF; }
+    int PeekChar() const { return cur + 1 < end ? static_cast<unsigned char>(cur[1]) : EOF; }
+    int NextChar()
+    {
+	if (cur < end)
+	{
+	    cur++;
+	}
+	return CurChar();
+    }
 
     Token NumberToken();
     Token StringToken();
 
-    Location Where() const { return source; }
+    // Locations are where the character reader used to be: one past the current character, or
+    // two past it after a number that looked ahead at "..", or when it had peeked past the '$' of
+    // a hex number.
+    Location Where(int ahead = 0) const
+    {
+	const char* pos = cur + 1 + lookahead + ahead;
+	return source.Where(pos < end ? pos : end);
+    }
 
 private:
-    Source& source;
-    int     curChar;
-    int     nextChar;
-    int     curValid;
+    Source&     source;
+    const char* cur;
+    const char* end;
+    int         lookahead;
 };
 
 #endif
@@ -46,8 +46,9 @@ public:
 	External = 1 << 1,
 	Protected = 1 << 2,
 	Closure = 1 << 3,
+	Imported = 1 << 4,
 	None = 0,
-	All = Reference | External | Protected | Closure,
+	All = Reference | External | Protected | Closure | Imported,
     };
 
     VarDef(const std::string& nm, Types::TypeDecl* ty, Flags f = Flags::None)
@@ -60,6 +61,7 @@ public:
     bool        IsExternal() const;
     bool        IsProtected() const;
     bool        IsClosure() const;
+    bool        IsImported() const;
     Flags       GetFlags() const { return flags; }
     ExprAST*    Init() { return init; }
     void        SetInit(ExprAST* i) { init = i; }
@@ -102,6 +104,10 @@ inline bool VarDef::IsClosure() const
 {
     return (flags & VarDef::Flags::Closure) != VarDef::Flags::None;
 }
+inline bool VarDef::IsImported() const
+{
+    return (flags & VarDef::Flags::Imported) != VarDef::Flags::None;
+}
 
 inline bool operator<(const VarDef& lhs, const VarDef& rhs)
 {
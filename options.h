@@ -37,6 +37,20 @@ extern bool        disableMemcpyOpt;
 extern bool        rangeCheck;
 extern bool        debugInfo;
 extern bool        callGraph;
+extern bool        runJit;
+extern bool        lldLink;
+extern bool        keepObject;
+extern bool        compileUnit;
+extern bool        wholeProgram;
+extern bool        runtimeBitcode;
+extern bool        setValues;
+extern bool        profileGenerate;
+extern unsigned    codegenThreads;
+extern std::string profileUse;
+extern std::string cacheDir;
+extern std::string traceFile;
+extern unsigned    cacheSize;
+extern bool        cacheStats;
 extern OptLevel    optimization;
 extern Model       model;
 extern bool        caseInsensitive;
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "binary.h"
 #include "builtin.h"
 #include "callgraph.h"
 #include "expr.h"
@@ -13,14 +14,19 @@
 
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APSInt.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MathExtras.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 enum ExpectConsuming
@@ -56,6 +62,7 @@ public:
 
     Parser(Source& source);
     ExprAST* Parse(ParserType type) override;
+    void     ImportUnit(const std::vector<std::string>& inits);
 
     int GetErrors() override { return errCnt; }
 
@@ -109,9 +116,10 @@ public:
     BlockAST*     ParseBlock(Location& endLoc);
     FunctionAST*  ParseDefinition(int level);
     PrototypeAST* ParsePrototype(NamePolicy nmPolicy);
+    bool          ParseDirectives(PrototypeAST* proto);
     bool          ParseProgram(ParserType type);
     void          ParseLabels();
-    ExprAST*      ParseUses();
+    bool          ParseUses();
     ExprAST*      ParseUnit(ParserType type);
     bool          ParseInterface(InterfaceList& iList);
     void          ParseImports();
@@ -167,6 +175,7 @@ public:
     bool        IsSemicolonOrEnd();
     bool        ExpectSemicolonOrEnd(const char* file, int line);
     std::string GetIdentifier(const char* file, int line, ExpectConsuming consumption);
+    Ident       CurrentIdent() const;
 
     // General helper functions
     void ExpandWithNames(const Types::FieldCollection* fields, ExprAST* v, int parentCount);
@@ -179,10 +188,11 @@ public:
                           std::vector<ExprAST*>& args);
 
     // Helper functions for identifier access/checking
-    const EnumDef*              GetEnumValue(const std::string& name);
-    Types::TypeDecl*            GetTypeDecl(const std::string& name);
+    const EnumDef*              GetEnumValue(Ident name);
+    Types::TypeDecl*            GetTypeDecl(Ident name);
+    Types::TypeDecl*            GetTypeDecl(const std::string& name) { return GetTypeDecl(Intern(name)); }
     Types::TypeDecl*            GetTypeFromExpression();
-    const Constants::ConstDecl* GetConstDecl(const std::string& name);
+    const Constants::ConstDecl* GetConstDecl(Ident name);
     bool AddType(const std::string& name, Types::TypeDecl* type, bool restricted = false);
     bool AddConst(const std::string& name, const Constants::ConstDecl* cd);
 
@@ -212,6 +222,18 @@ private:
     int                       errCnt;
     Stack<const NamedObject*> nameStack;
     std::vector<ExprAST*>     ast;
+    // Separate compilation of units.
+    bool                     importUnit;
+    std::vector<std::string> importInits;
+    bool                     recordTokens;
+    std::vector<Token>       interfaceTokens;
+    // Units are parsed on worker threads, so only the parser of the program itself adds the objects
+    // of used units to the link. The parser of a unit passes them on to its user.
+    bool                     topLevel;
+    std::vector<std::string> unitObjects;
+
+    struct UsedUnit;
+    static void ParseUsedUnit(UsedUnit& unit);
 };
 
 using NameWrapper = StackWrapper<const NamedObject*>;
@@ -317,6 +339,10 @@ void Parser::NextToken(const char* file, int line)
     {
 	curToken = lexer.GetToken();
     }
+    if (recordTokens)
+    {
+	interfaceTokens.push_back(curToken);
+    }
     if (verbosity)
     {
 	std::cerr << file << ": " << line << ": ";
@@ -357,6 +383,16 @@ std::string Parser::GetIdentifier(const char* file, int line, ExpectConsuming co
     return "";
 }
 
+// The name of the current token as interned by the lexer, or 0 if it isn't an identifier.
+Ident Parser::CurrentIdent() const
+{
+    if (CurrentToken().GetToken() == Token::Identifier)
+    {
+	return CurrentToken().GetIdent();
+    }
+    return 0;
+}
+
 bool Parser::Expect(Token::TokenType type, ExpectConsuming consumption, const char* file, int line)
 {
     if (CurrentToken().GetToken() != type)
@@ -422,8 +458,12 @@ bool Parser::AcceptToken(Token::TokenType type, const char* file, int line)
 #define Error(a, ...) Error(__FILE__, __LINE__, a __VA_OPT__(, ) __VA_ARGS__)
 #define ErrorT(T, a, ...) Error<T>(__FILE__, __LINE__, a __VA_OPT__(, ) __VA_ARGS__)
 
-Types::TypeDecl* Parser::GetTypeDecl(const std::string& name)
+Types::TypeDecl* Parser::GetTypeDecl(Ident name)
 {
+    if (!name)
+    {
+	return 0;
+    }
     if (const auto typeDef = llvm::dyn_cast_or_null<const TypeDef>(nameStack.Find(name)))
     {
 	return typeDef->Type();
@@ -433,14 +473,10 @@ Types::TypeDecl* Parser::GetTypeDecl(const std::string& name)
 
 Types::TypeDecl* Parser::GetTypeFromExpression()
 {
-    std::string name = GetIdentifier(NoExpectConsume);
-    if (!name.empty())
+    if (Types::TypeDecl* ty = GetTypeDecl(CurrentIdent()))
     {
-	if (Types::TypeDecl* ty = GetTypeDecl(name))
-	{
-	    AssertToken(Token::Identifier);
-	    return ty;
-	}
+	AssertToken(Token::Identifier);
+	return ty;
     }
     if (ExprAST* e = ParseExpression())
     {
@@ -478,7 +514,7 @@ ExprAST* Parser::ParseDefaultExpr()
 	return 0;
     }
     ExprAST*         expr = 0;
-    Types::TypeDecl* ty = GetTypeDecl(GetIdentifier(NoExpectConsume));
+    Types::TypeDecl* ty = GetTypeDecl(CurrentIdent());
     if (!ty)
     {
 	if (ExprAST* e = ParseExpression())
@@ -556,7 +592,7 @@ ExprAST* Parser::ParseGoto()
     return 0;
 }
 
-const Constants::ConstDecl* Parser::GetConstDecl(const std::string& name)
+const Constants::ConstDecl* Parser::GetConstDecl(Ident name)
 {
     if (const auto constDef = llvm::dyn_cast_or_null<const ConstDef>(nameStack.Find(name)))
     {
@@ -565,7 +601,7 @@ const Constants::ConstDecl* Parser::GetConstDecl(const std::string& name)
     return 0;
 }
 
-const EnumDef* Parser::GetEnumValue(const std::string& name)
+const EnumDef* Parser::GetEnumValue(Ident name)
 {
     return llvm::dyn_cast_or_null<EnumDef>(nameStack.Find(name));
 }
@@ -590,7 +626,7 @@ Types::TypeDecl* Parser::ParseSimpleType(bool errOnNoType)
     std::string name = GetIdentifier(NoExpectConsume);
     if (!name.empty())
     {
-	if (Types::TypeDecl* ty = GetTypeDecl(name))
+	if (Types::TypeDecl* ty = GetTypeDecl(CurrentIdent()))
 	{
 	    AssertToken(Token::Identifier);
 	    return ty;
@@ -607,7 +643,7 @@ Token Parser::TranslateToken(const Token& token)
 {
     if (token.GetToken() == Token::Identifier)
     {
-	if (const Constants::ConstDecl* cd = GetConstDecl(token.GetIdentName()))
+	if (const Constants::ConstDecl* cd = GetConstDecl(token.GetIdent()))
 	{
 	    if (!llvm::isa<Constants::CompoundConstDecl, Constants::SetConstDecl, Constants::EnumConstDecl>(
 	            cd))
@@ -651,7 +687,7 @@ int64_t Parser::ParseConstantValue(Token::TokenType& tt, Types::TypeDecl*& type)
     {
 	tt = CurrentToken().GetToken();
 
-	std::string name = CurrentToken().GetIdentName();
+	Ident name = CurrentToken().GetIdent();
 
 	if (const Constants::ConstDecl* cd = GetConstDecl(name))
 	{
@@ -735,7 +771,7 @@ Types::RangeBaseDecl* Parser::ParseRange(Types::TypeDecl*& type, Token::TokenTyp
 	    {
 		return 0;
 	    }
-	    if ((type = GetTypeDecl(GetIdentifier(NoExpectConsume))))
+	    if ((type = GetTypeDecl(CurrentIdent())))
 	    {
 		NextToken();
 		return new Types::DynRangeDecl(lowName, highName, type);
@@ -790,8 +826,7 @@ Types::RangeBaseDecl* Parser::ParseRange(Types::TypeDecl*& type, Token::TokenTyp
 Types::RangeBaseDecl* Parser::ParseRangeOrTypeRange(Types::TypeDecl*& type, Token::TokenType endToken,
                                                     Token::TokenType altToken, Types::Schema* schema)
 {
-    std::string name = GetIdentifier(NoExpectConsume);
-    if ((type = GetTypeDecl(name)))
+    if ((type = GetTypeDecl(CurrentIdent())))
     {
 	if (!IsIntegral(type))
 	{
@@ -1069,10 +1104,11 @@ const Constants::ConstDecl* Parser::ParseConstTerm(const Location& loc)
     case Token::Identifier:
     {
 	std::string name = GetIdentifier(NoExpectConsume);
+	Ident       id = CurrentIdent();
 	if ((cd = ParseConstFunction(name)))
 	{
 	}
-	else if (const EnumDef* ed = GetEnumValue(name))
+	else if (const EnumDef* ed = GetEnumValue(id))
 	{
 	    if (llvm::isa<Types::BoolDecl>(ed->Type()))
 	    {
@@ -1099,7 +1135,7 @@ const Constants::ConstDecl* Parser::ParseConstTerm(const Location& loc)
 	}
 	else
 	{
-	    if (!(cd = GetConstDecl(name)))
+	    if (!(cd = GetConstDecl(id)))
 	    {
 		return 0;
 	    }
@@ -1206,8 +1242,7 @@ void Parser::ParseConstDef()
 	{
 	    return;
 	}
-	std::string val = GetIdentifier(NoExpectConsume);
-	if (Types::TypeDecl* ty = GetTypeDecl(val))
+	if (Types::TypeDecl* ty = GetTypeDecl(CurrentIdent()))
 	{
 	    AssertToken(Token::Identifier);
 	    if (auto init = ParseInitValue(ty))
@@ -1475,6 +1510,10 @@ Types::PointerDecl* Parser::ParsePointerType(Forwarding maybeForwarded)
 	    // Is it a known type?
 	    if (Types::TypeDecl* ty = GetTypeDecl(name))
 	    {
+		if (llvm::isa<Types::LongStringDecl>(ty))
+		{
+		    return Error("Pointer to ansistring is not supported");
+		}
 		return new Types::PointerDecl(ty);
 	    }
 	    else
@@ -1489,6 +1528,10 @@ Types::PointerDecl* Parser::ParsePointerType(Forwarding maybeForwarded)
 
     if (Types::TypeDecl* ty = ParseType("", NoForwarding))
     {
+	if (llvm::isa<Types::LongStringDecl>(ty))
+	{
+	    return Error("Pointer to ansistring is not supported");
+	}
 	return new Types::PointerDecl(ty);
     }
     return 0;
@@ -1533,6 +1576,10 @@ Types::TypeDecl* Parser::ParseArrayDecl(Types::Schema* schema)
 	{
 	    if (Types::TypeDecl* ty = ParseType("", NoForwarding))
 	    {
+		if (llvm::isa<Types::LongStringDecl>(ty))
+		{
+		    return Error("Array of ansistring is not supported");
+		}
 		if (dr)
 		{
 		    return new Types::DynArrayDecl(ty, dr);
@@ -1648,6 +1695,10 @@ Types::VariantDecl* Parser::ParseVariantDecl(Types::FieldDecl*& markerField)
 
 		    if (Types::TypeDecl* ty = ParseType("", NoForwarding))
 		    {
+			if (llvm::isa<Types::LongStringDecl>(ty))
+			{
+			    return Error("Field of type ansistring is not supported");
+			}
 			if (AcceptToken(Token::Value))
 			{
 			    ExprAST* init = ParseInitValue(ty);
@@ -1768,13 +1819,9 @@ bool Parser::ParseFields(std::vector<Types::FieldDecl*>& fields, Types::VariantD
 		    return false;
 		}
 	    }
-	    // Ignore "inline" token
-	    if (AcceptToken(Token::Inline))
+	    if (!ParseDirectives(p))
 	    {
-		if (!Expect(Token::Semicolon, ExpectConsume))
-		{
-		    return false;
-		}
+		return false;
 	    }
 	    Types::MemberFuncDecl* m = new Types::MemberFuncDecl(p, f);
 	    fields.push_back(new Types::FieldDecl(p->Name(), m, false));
@@ -1792,6 +1839,10 @@ bool Parser::ParseFields(std::vector<Types::FieldDecl*>& fields, Types::VariantD
 		ICE_IF(ccv.Names().empty(), "Should have some names here...");
 		if (Types::TypeDecl* ty = ParseType("", NoForwarding))
 		{
+		    if (llvm::isa<Types::LongStringDecl>(ty))
+		    {
+			return ErrorT(bool, "Field of type ansistring is not supported");
+		    }
 		    if (AcceptToken(Token::Value))
 		    {
 			ExprAST* init = ParseInitValue(ty);
@@ -1877,6 +1928,10 @@ Types::FileDecl* Parser::ParseFileDecl()
     {
 	if (Types::TypeDecl* type = ParseType("", NoForwarding))
 	{
+	    if (llvm::isa<Types::LongStringDecl>(type))
+	    {
+		return Error("File of ansistring is not supported");
+	    }
 	    return new Types::FileDecl(type);
 	}
     }
@@ -2057,14 +2112,17 @@ Types::TypeDecl* Parser::ParseType(const std::string& name, Forwarding maybeForw
 	{
 	    return 0;
 	}
-	std::string varName = GetIdentifier(ExpectConsume);
-	if (const NamedObject* def = nameStack.Find(varName))
+	Ident varName = CurrentIdent();
+	if (AcceptToken(Token::Identifier))
 	{
-	    if (!llvm::isa<VarDef>(def))
+	    if (const NamedObject* def = nameStack.Find(varName))
 	    {
-		return Error("Expected variable name");
+		if (!llvm::isa<VarDef>(def))
+		{
+		    return Error("Expected variable name");
+		}
+		return def->Type();
 	    }
-	    return def->Type();
 	}
 	return Error("Expected an identifier for 'type of'");
     }
@@ -2072,7 +2130,7 @@ Types::TypeDecl* Parser::ParseType(const std::string& name, Forwarding maybeForw
 
     case Token::Identifier:
     {
-	if (!GetEnumValue(GetIdentifier(NoExpectConsume)))
+	if (!GetEnumValue(CurrentIdent()))
 	{
 	    if (Types::TypeDecl* ty = ParseSimpleType(false))
 	    {
@@ -2341,6 +2399,15 @@ ExprAST* Parser::ParseArrayExpr(ExprAST* expr, Types::TypeDecl*& type)
 	return 0;
     }
     std::vector<ExprAST*> indices = cce.Exprs();
+    if (llvm::isa<Types::LongStringDecl>(type))
+    {
+	if (indices.size() != 1)
+	{
+	    return Error("Too many indices");
+	}
+	type = Types::Get<Types::CharDecl>();
+	return new LongStringIndexAST(CurrentToken().Loc(), expr, indices[0]);
+    }
     while (!indices.empty())
     {
 	RangeExprAST* range;
@@ -2453,7 +2520,7 @@ ExprAST* Parser::MakeSelfCall(ExprAST* self, Types::MemberFuncDecl* mf, Types::C
     if (mf->IsVirtual() || mf->IsOverride())
     {
 	int                 index = mf->VirtIndex();
-	Types::FuncPtrDecl* funcPtr = new Types::FuncPtrDecl(proto);
+	Types::FuncPtrDecl* funcPtr = new Types::FuncPtrDecl(proto, Types::FuncPtrDecl::Plain);
 	expr = new VirtFunctionAST(CurrentToken().Loc(), self, index, funcPtr);
     }
     else
@@ -2698,8 +2765,8 @@ bool Parser::ParseArgs(const NamedObject* def, std::vector<ExprAST*>& args)
 	    ExprAST* arg = 0;
 	    if (isFuncArg)
 	    {
-		std::string idName = GetIdentifier(ExpectConsume);
-		if (!idName.empty())
+		Ident idName = CurrentIdent();
+		if (AcceptToken(Token::Identifier))
 		{
 		    if (const NamedObject* argDef = nameStack.Find(idName))
 		    {
@@ -2843,9 +2910,11 @@ ExprAST* Parser::ParseCallOrVariableExpr(const Token& token)
 {
     TRACE();
 
-    std::string idName = token.GetIdentName();
+    // The token may be the current one, which AssertToken replaces.
+    std::string        idName = token.GetIdentName();
+    Ident              id = token.GetIdent();
     AssertToken(Token::Identifier);
-    const NamedObject* def = nameStack.Find(idName);
+    const NamedObject* def = nameStack.Find(id);
     if (const auto constDef = llvm::dyn_cast_or_null<const ConstDef>(def))
     {
 	const Constants::ConstDecl* cd = constDef->ConstValue();
@@ -3203,8 +3272,7 @@ ExprAST* Parser::ParseInitValue(Types::TypeDecl* ty)
     }
     if (auto arrTy = llvm::dyn_cast<Types::ArrayDecl>(ty))
     {
-	std::string name = GetIdentifier(NoExpectConsume);
-	if (!name.empty())
+	if (Ident name = CurrentIdent())
 	{
 	    if (const Constants::ConstDecl* cd = GetConstDecl(name))
 	    {
@@ -3279,6 +3347,10 @@ VarDeclAST* Parser::ParseVarDecls()
 		ExprAST* init = 0;
 		if (AcceptToken(Token::Value))
 		{
+		    if (llvm::isa<Types::LongStringDecl>(type))
+		    {
+			return Error("Initial value for ansistring is not supported");
+		    }
 		    init = ParseInitValue(type);
 		    if (!init)
 		    {
@@ -3607,12 +3679,71 @@ BlockAST* Parser::ParseBlock(Location& endLoc)
     return new BlockAST(loc, v);
 }
 
+// Directives after a function heading, each followed by a semicolon:
+//   inline; noinline; hot; cold; flatten;
+// Apart from "inline", these are not reserved words, so they are only taken as directives when
+// followed by a semicolon.
+bool Parser::ParseDirectives(PrototypeAST* proto)
+{
+    for (;;)
+    {
+	PrototypeAST::Attributes attr;
+	if (CurrentToken().GetToken() == Token::Inline)
+	{
+	    attr = PrototypeAST::Inline;
+	}
+	else if (CurrentToken().GetToken() == Token::Identifier && PeekToken() == Token::Semicolon)
+	{
+	    std::string name = CurrentToken().GetIdentName();
+	    strlower(name);
+	    if (name == "noinline")
+	    {
+		attr = PrototypeAST::NoInline;
+	    }
+	    else if (name == "hot")
+	    {
+		attr = PrototypeAST::Hot;
+	    }
+	    else if (name == "cold")
+	    {
+		attr = PrototypeAST::Cold;
+	    }
+	    else if (name == "flatten")
+	    {
+		attr = PrototypeAST::Flatten;
+	    }
+	    else
+	    {
+		return true;
+	    }
+	}
+	else
+	{
+	    return true;
+	}
+	NextToken();
+	if (!Expect(Token::Semicolon, ExpectConsume))
+	{
+	    return false;
+	}
+	proto->AddAttribute(attr);
+	if (proto->HasAttribute(PrototypeAST::Inline) && proto->HasAttribute(PrototypeAST::NoInline))
+	{
+	    return ErrorT(bool, "Function '" + proto->Name() + "' can't be both inline and noinline");
+	}
+	if (proto->HasAttribute(PrototypeAST::Hot) && proto->HasAttribute(PrototypeAST::Cold))
+	{
+	    return ErrorT(bool, "Function '" + proto->Name() + "' can't be both hot and cold");
+	}
+    }
+}
+
 FunctionAST* Parser::ParseDefinition(int level)
 {
     TRACE();
 
     PrototypeAST* proto = ParsePrototype(NamePolicy::Named);
-    if (!proto || !Expect(Token::Semicolon, ExpectConsume))
+    if (!proto || !Expect(Token::Semicolon, ExpectConsume) || !ParseDirectives(proto))
     {
 	return 0;
     }
@@ -3627,14 +3758,6 @@ FunctionAST* Parser::ParseDefinition(int level)
     if (!(fnDef && fnDef->Proto() && fnDef->Proto() == proto))
     {
 	shortname = ShortName(name);
-	// Allow "inline" keyword. Currently ignored...
-	if (AcceptToken(Token::Inline))
-	{
-	    if (!Expect(Token::Semicolon, ExpectConsume))
-	    {
-		return 0;
-	    }
-	}
 	if (Types::ClassDecl* cd = proto->BaseObj())
 	{
 	    int elem = cd->MembFunc(shortname);
@@ -3819,8 +3942,8 @@ ExprAST* Parser::ParseForExpr()
     AssertToken(Token::For);
     const Location loc = CurrentToken().Loc();
 
-    std::string varName = GetIdentifier(ExpectConsume);
-    if (varName.empty())
+    Ident varName = CurrentIdent();
+    if (!AcceptToken(Token::Identifier))
     {
 	return Error("Expected identifier name, got " + CurrentToken().ToString());
     }
@@ -4460,51 +4583,222 @@ bool Parser::ParseProgram(ParserType type)
     return false;
 }
 
-ExprAST* Parser::ParseUses()
+// The interface file starts with lines of "{ #init name }" and "{ #object filename }", giving the
+// initialisation functions and the object files needed by the unit.
+static void ReadInterfaceHeader(const std::string& fileName, std::vector<std::string>& inits,
+                                std::vector<std::string>& objects)
+{
+    std::ifstream input(fileName);
+    std::string   line;
+    while (std::getline(input, line) && line.substr(0, 3) == "{ #" && line.size() > 5)
+    {
+	std::string            content = line.substr(3, line.size() - 5);
+	std::string::size_type pos = content.find(' ');
+	std::string            kind = content.substr(0, pos);
+	std::string            name = content.substr(pos + 1);
+	if (kind == "init")
+	{
+	    inits.push_back(name);
+	}
+	else if (kind == "object")
+	{
+	    objects.push_back(name);
+	}
+    }
+}
+
+static std::string QuoteString(const std::string& str)
+{
+    std::string res = "'";
+    for (auto c : str)
+    {
+	res += c;
+	if (c == '\'')
+	{
+	    res += c;
+	}
+    }
+    return res + "'";
+}
+
+static std::string TokenText(const Token& t)
+{
+    switch (t.GetToken())
+    {
+    case Token::Identifier:
+	return t.GetIdentName();
+
+    case Token::Integer:
+	return std::to_string(t.GetIntVal());
+
+    case Token::Real:
+    {
+	std::stringstream ss;
+	ss << std::scientific << std::setprecision(17) << t.GetRealVal();
+	return ss.str();
+    }
+
+    case Token::Char:
+	return QuoteString(std::string(1, static_cast<char>(t.GetIntVal())));
+
+    case Token::StringLiteral:
+	return QuoteString(t.GetStrVal());
+
+    default:
+	return t.TypeStr();
+    }
+}
+
+// Make a unit with only the interface part, for the interface file.
+static std::string InterfaceSource(const std::string& unitName, const std::vector<Token>& tokens)
+{
+    std::string text = "unit " + unitName + ";\ninterface\n";
+    for (auto& t : tokens)
+    {
+	text += TokenText(t);
+	text += (t.GetToken() == Token::Semicolon) ? "\n" : " ";
+    }
+    return text + "implementation\nend.\n";
+}
+
+void Parser::ImportUnit(const std::vector<std::string>& inits)
+{
+    importUnit = true;
+    importInits = inits;
+}
+
+// A unit named in a uses clause. Each unit has its own parser, so the units of one uses clause
+// are parsed at the same time, and the results merged afterwards in the order they are listed.
+struct Parser::UsedUnit
+{
+    std::string              name;
+    std::string              path;
+    bool                     opened = false;
+    ExprAST*                 ast = 0;
+    int                      errors = 0;
+    std::vector<std::string> objects;
+};
+
+void Parser::ParseUsedUnit(UsedUnit& unit)
+{
+    TIME_TRACE_SCOPE("ParseUses", unit.name);
+    std::string fileName = unit.path + "/" + unit.name + ".pas";
+    std::string ifaceName = unit.path + "/" + unit.name + ".pi";
+    std::string objName = unit.path + "/" + unit.name + ".o";
+    // Use the result of compiling the unit with -unit, if it's newer than the source.
+    bool       useIface = IsUpToDate(ifaceName, fileName) && IsUpToDate(objName, fileName);
+    FileSource source(useIface ? ifaceName : fileName);
+    if (!source)
+    {
+	return;
+    }
+    unit.opened = true;
+    Parser p(source);
+    p.topLevel = false;
+    if (useIface)
+    {
+	std::vector<std::string> inits;
+	ReadInterfaceHeader(ifaceName, inits, unit.objects);
+	unit.objects.push_back(objName);
+	p.ImportUnit(inits);
+    }
+    unit.ast = p.Parse(ParserType::Unit);
+    unit.errors = p.GetErrors();
+    unit.objects.insert(unit.objects.end(), p.unitObjects.begin(), p.unitObjects.end());
+}
+
+bool Parser::ParseUses()
 {
     AssertToken(Token::Uses);
-    std::string unitname = GetIdentifier(ExpectConsume);
-    if (!unitname.empty())
+    std::string           path = GetPath(CurrentToken().Loc().FileName());
+    std::vector<UsedUnit> units;
+    do
     {
-	if (unitname == "math")
+	std::string unitname = GetIdentifier(ExpectConsume);
+	if (unitname.empty())
 	{
-	    if (Expect(Token::Semicolon, ExpectConsume))
-	    {
-		// Math unit is "fake", so nothing inside it for now
-		return new UnitAST(CurrentToken().Loc(), {}, 0, {});
-	    }
+	    return ErrorT(bool, "Expected unit name");
 	}
-	else
+	strlower(unitname);
+	// Math unit is "fake", so nothing inside it for now
+	if (unitname != "math")
+	{
+	    UsedUnit u;
+	    u.name = unitname;
+	    u.path = path;
+	    units.push_back(u);
+	}
+    } while (AcceptToken(Token::Comma));
+    if (!Expect(Token::Semicolon, ExpectConsume))
+    {
+	return false;
+    }
+
+    std::atomic<size_t> next(0);
+    Arena*              arena = Arena::Current();
+    auto                worker = [&]()
+    {
+	Arena::ThreadScope scope(arena);
+	TimeTraceThread    traceThread;
+	for (size_t i = next++; i < units.size(); i = next++)
+	{
+	    ParseUsedUnit(units[i]);
+	}
+    };
+    size_t numThreads = std::min<size_t>(std::thread::hardware_concurrency(), units.size());
+    if (numThreads <= 1)
+    {
+	worker();
+    }
+    else
+    {
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < numThreads; t++)
+	{
+	    threads.emplace_back(worker);
+	}
+	for (auto& t : threads)
 	{
-	    // TODO: Loop over comma separated list
-	    strlower(unitname);
-	    std::string path = GetPath(CurrentToken().Loc().FileName());
-	    std::string fileName = path + "/" + unitname + ".pas";
-	    FileSource  source(fileName);
-	    if (!source)
+	    t.join();
+	}
+    }
+
+    bool ok = true;
+    for (auto& u : units)
+    {
+	if (!u.opened)
+	{
+	    return ErrorT(bool, "Could not open " + u.path + "/" + u.name + ".pas");
+	}
+	errCnt += u.errors;
+	for (auto& o : u.objects)
+	{
+	    if (topLevel)
+	    {
+		AddLinkObject(o);
+	    }
+	    else
 	    {
-		return Error("Could not open " + fileName);
+		unitObjects.push_back(o);
 	    }
-	    Parser   p(source);
-	    ExprAST* e = p.Parse(ParserType::Unit);
-	    errCnt += p.GetErrors();
-	    if (Expect(Token::Semicolon, ExpectConsume))
+	}
+	if (auto ua = llvm::dyn_cast_or_null<UnitAST>(u.ast))
+	{
+	    for (auto i : ua->Interface().List())
 	    {
-		if (auto ua = llvm::dyn_cast_or_null<UnitAST>(e))
+		if (!nameStack.Add(i.second))
 		{
-		    for (auto i : ua->Interface().List())
-		    {
-			if (!nameStack.Add(i.second))
-			{
-			    return 0;
-			}
-		    }
+		    return false;
 		}
-		return e;
 	    }
+	    ast.push_back(ua);
+	}
+	else
+	{
+	    ok = false;
 	}
     }
-    return 0;
+    return ok;
 }
 
 bool Parser::ParseInterface(InterfaceList& iList)
@@ -4520,17 +4814,11 @@ bool Parser::ParseInterface(InterfaceList& iList)
 	    break;
 
 	case Token::Uses:
-	{
-	    if (ExprAST* e = ParseUses())
-	    {
-		ast.push_back(e);
-	    }
-	    else
+	    if (!ParseUses())
 	    {
 		return false;
 	    }
-	}
-	break;
+	    break;
 
 	case Token::Procedure:
 	case Token::Function:
@@ -4541,6 +4829,17 @@ bool Parser::ParseInterface(InterfaceList& iList)
 		return false;
 	    }
 	    proto->SetIsForward(true);
+	    if (compileUnit || importUnit)
+	    {
+		proto->SetIsExternal(true);
+	    }
+	    if (importUnit)
+	    {
+		// The body of the function is in the object file of the unit.
+		FunctionAST* fn = new FunctionAST(proto->Loc(), proto, {}, 0);
+		proto->SetFunction(fn);
+		ast.push_back(fn);
+	    }
 	    std::string      name = proto->Name();
 	    Types::TypeDecl* ty = new Types::FunctionDecl(proto);
 	    FuncDef*         nmObj = new FuncDef(name, ty, proto);
@@ -4554,6 +4853,14 @@ bool Parser::ParseInterface(InterfaceList& iList)
 	case Token::Var:
 	    if (VarDeclAST* v = ParseVarDecls())
 	    {
+		if (importUnit)
+		{
+		    v->AddFlags(VarDef::Flags::External | VarDef::Flags::Imported);
+		}
+		else if (compileUnit)
+		{
+		    v->AddFlags(VarDef::Flags::External);
+		}
 		ast.push_back(v);
 	    }
 	    break;
@@ -4566,7 +4873,7 @@ bool Parser::ParseInterface(InterfaceList& iList)
 	    break;
 	}
     } while (CurrentToken().GetToken() != Token::Implementation);
-    for (auto i : nameStack.GetLevel())
+    for (auto& i : nameStack.GetLevel())
     {
 	iList.Add(i.second);
     }
@@ -4610,7 +4917,10 @@ ExprAST* Parser::ParseUnit(ParserType type)
 	    return Error("Unexpected end of file");
 
 	case Token::Uses:
-	    curAst = ParseUses();
+	    if (!ParseUses())
+	    {
+		return 0;
+	    }
 	    break;
 
 	case Token::Import:
@@ -4639,10 +4949,16 @@ ExprAST* Parser::ParseUnit(ParserType type)
 	    break;
 
 	case Token::Interface:
+	    recordTokens = compileUnit;
 	    if (!ParseInterface(interfaceList))
 	    {
 		return 0;
 	    }
+	    recordTokens = false;
+	    if (!interfaceTokens.empty() && interfaceTokens.back().GetToken() == Token::Implementation)
+	    {
+		interfaceTokens.pop_back();
+	    }
 	    for (auto i : interfaceList.List())
 	    {
 		if (!nameStack.Add(i.second))
@@ -4701,7 +5017,37 @@ ExprAST* Parser::ParseUnit(ParserType type)
 	    ast.push_back(curAst);
 	}
     } while (!finished);
-    return new UnitAST(unitloc, ast, initFunction, interfaceList);
+
+    if (type != ParserType::Program && importUnit)
+    {
+	// The initialisation functions are in the object files of the unit.
+	for (auto name : importInits)
+	{
+	    PrototypeAST* proto = new PrototypeAST(unitloc, name, {}, Types::Get<Types::VoidDecl>(), "", 0);
+	    proto->SetIsForward(true);
+	    proto->SetIsExternal(true);
+	    FunctionAST* fn = new FunctionAST(unitloc, proto, {}, 0);
+	    ast.push_back(new UnitAST(unitloc, {}, fn, {}));
+	}
+    }
+    else if (type != ParserType::Program && compileUnit)
+    {
+	// The program using the unit always calls the initialisation function.
+	if (!initFunction)
+	{
+	    PrototypeAST* proto =
+	        new PrototypeAST(unitloc, initName, {}, Types::Get<Types::VoidDecl>(), "", 0);
+	    initFunction = new FunctionAST(unitloc, proto, {}, new BlockAST(unitloc, {}));
+	}
+	initFunction->Proto()->SetIsExternal(true);
+    }
+
+    UnitAST* unit = new UnitAST(unitloc, ast, initFunction, interfaceList);
+    if (compileUnit)
+    {
+	unit->SetInterfaceText(InterfaceSource(moduleName, interfaceTokens));
+    }
+    return unit;
 }
 
 ExprAST* Parser::Parse(ParserType type)
@@ -4709,8 +5055,14 @@ ExprAST* Parser::Parse(ParserType type)
     TIME_TRACE();
 
     NextToken();
-    VarDef input("input", Types::Get<Types::TextDecl>(), VarDef::Flags::External);
-    VarDef output("output", Types::Get<Types::TextDecl>(), VarDef::Flags::External);
+    // Only the program defines input and output.
+    VarDef::Flags ioFlags = VarDef::Flags::External;
+    if (type != ParserType::Program)
+    {
+	ioFlags |= VarDef::Flags::Imported;
+    }
+    VarDef input("input", Types::Get<Types::TextDecl>(), ioFlags);
+    VarDef output("output", Types::Get<Types::TextDecl>(), ioFlags);
     nameStack.Add(new VarDef(input));
     nameStack.Add(new VarDef(output));
     std::vector<VarDef> varList{ input, output };
@@ -4719,7 +5071,8 @@ ExprAST* Parser::Parse(ParserType type)
     return ParseUnit(type);
 }
 
-Parser::Parser(Source& source) : lexer(source), nextTokenValid(false), errCnt(0)
+Parser::Parser(Source& source)
+    : lexer(source), nextTokenValid(false), errCnt(0), importUnit(false), recordTokens(false), topLevel(true)
 {
     const llvm::fltSemantics& sem = llvm::APFloat::IEEEdouble();
     double                    maxReal = llvm::APFloat::getLargest(sem).convertToDouble();
@@ -4734,6 +5087,7 @@ Parser::Parser(Source& source) : lexer(source), nextTokenValid(false), errCnt(0)
           AddType("timestamp", Types::GetTimeStampType()) &&
           AddType("bindingtype", Types::GetBindingType()) &&
           AddType("complex", Types::Get<Types::ComplexDecl>()) &&
+          AddType("ansistring", Types::Get<Types::LongStringDecl>()) &&
           nameStack.Add(new EnumDef("false", 0, Types::Get<Types::BoolDecl>())) &&
           nameStack.Add(new EnumDef("true", 1, Types::Get<Types::BoolDecl>())) &&
           AddConst("maxint", new Constants::IntConstDecl(unknownLoc, INT_MAX)) &&
@@ -5,9 +5,15 @@
  * Memory allocation functions
  *******************************************
  */
+/* Never returns NULL, which the compiler relies on. */
 void* __new(int size)
 {
-    return malloc(size);
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (!ptr)
+    {
+	__Panic("Out of memory in new");
+    }
+    return ptr;
 }
 
 void __dispose(void* ptr)
@@ -0,0 +1,225 @@
+#include "runtime.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************
+ * Long string functions
+ *******************************************
+ * Blocks are shared between variables, and counted. A function returning a long string gives the
+ * caller one reference, which it must release or store. Blocks are copied before a change when
+ * anyone else holds a reference (copy on write).
+ */
+static LongString* NewLongString(int len, int size)
+{
+    LongString* s = malloc(sizeof(LongString) + size);
+    if (!s)
+    {
+	__Panic("Out of memory in string");
+    }
+    s->refs = 1;
+    s->len = len;
+    s->size = size;
+    return s;
+}
+
+static LongString* MakeLongString(const unsigned char* str, int len)
+{
+    if (len <= 0)
+    {
+	return NULL;
+    }
+    LongString* s = NewLongString(len, len);
+    memcpy(s->str, str, len);
+    return s;
+}
+
+LongString* __LStrAddRef(LongString* s)
+{
+    if (s && s->refs > 0)
+    {
+	s->refs++;
+    }
+    return s;
+}
+
+void __LStrRelease(LongString* s)
+{
+    if (s && s->refs > 0 && --s->refs == 0)
+    {
+	free(s);
+    }
+}
+
+/* Store src in *dest, where the caller keeps its own reference to src. */
+void __LStrAssign(LongString** dest, LongString* src)
+{
+    __LStrAddRef(src);
+    __LStrRelease(*dest);
+    *dest = src;
+}
+
+/* Store src in *dest, handing over the caller's reference. */
+void __LStrMove(LongString** dest, LongString* src)
+{
+    __LStrRelease(*dest);
+    *dest = src;
+}
+
+/* Give *s a block of its own, before it is changed. */
+LongString* __LStrUnique(LongString** s)
+{
+    LongString* old = *s;
+    if (old && old->refs != 1)
+    {
+	*s = MakeLongString(old->str, old->len);
+	__LStrRelease(old);
+    }
+    return *s;
+}
+
+int __LStrLength(const LongString* s)
+{
+    return s ? s->len : 0;
+}
+
+/* Address of the character at index, counting from 1. */
+unsigned char* __LStrCharAddr(LongString* s, int index)
+{
+    if (index < 1 || index > __LStrLength(s))
+    {
+	__Panic("Index out of range in string");
+    }
+    return &s->str[index - 1];
+}
+
+LongString* __LStrFromStr(const String* s)
+{
+    return MakeLongString(s->str, s->len);
+}
+
+/* Convert to a short string of the given capacity, truncating if needed. */
+void __LStrToStr(String* res, const LongString* s, int capacity)
+{
+    int len = __LStrLength(s);
+    if (len > capacity)
+    {
+	len = capacity;
+    }
+    res->len = len;
+    if (len)
+    {
+	memcpy(res->str, s->str, len);
+    }
+}
+
+LongString* __LStrConcat(LongString* a, LongString* b)
+{
+    if (!a)
+    {
+	return __LStrAddRef(b);
+    }
+    if (!b)
+    {
+	return __LStrAddRef(a);
+    }
+    LongString* s = NewLongString(a->len + b->len, a->len + b->len);
+    memcpy(s->str, a->str, a->len);
+    memcpy(&s->str[a->len], b->str, b->len);
+    return s;
+}
+
+/* Append to *s, in place when it isn't shared and has room. A new block gets twice the room it
+ * needs, so that a loop appending to a string takes linear time.
+ */
+void LongStringAppend(LongString** s, const unsigned char* str, int len)
+{
+    if (len <= 0)
+    {
+	return;
+    }
+    LongString* old = *s;
+    int         oldLen = __LStrLength(old);
+    if (!old || old->refs != 1 || oldLen + len > old->size)
+    {
+	/* str may be in the old block, so that is released last. */
+	LongString* n = NewLongString(oldLen + len, 2 * (oldLen + len));
+	if (old)
+	{
+	    memcpy(n->str, old->str, oldLen);
+	}
+	memcpy(&n->str[oldLen], str, len);
+	__LStrRelease(old);
+	*s = n;
+	return;
+    }
+    memcpy(&old->str[oldLen], str, len);
+    old->len += len;
+}
+
+void __LStrAppend(LongString** s, const LongString* b)
+{
+    if (b)
+    {
+	LongStringAppend(s, b->str, b->len);
+    }
+}
+
+void __LStrAppendStr(LongString** s, const String* b)
+{
+    LongStringAppend(s, b->str, b->len);
+}
+
+void __LStrAppendChar(LongString** s, unsigned char c)
+{
+    LongStringAppend(s, &c, 1);
+}
+
+/* Return >0 if a is greater than b,
+ * Return <0 if a is less than b.
+ * Return 0 if a == b.
+ */
+int __LStrCompare(const LongString* a, const LongString* b)
+{
+    int alen = __LStrLength(a);
+    int blen = __LStrLength(b);
+    int shortest = (alen < blen) ? alen : blen;
+    if (shortest)
+    {
+	int res = memcmp(a->str, b->str, shortest);
+	if (res)
+	{
+	    return res;
+	}
+    }
+    return alen - blen;
+}
+
+/* Return substring of input */
+LongString* __LStrCopy(const LongString* s, int start, int len)
+{
+    int slen = __LStrLength(s);
+    if (start < 1 || len <= 0 || start > slen)
+    {
+	return NULL;
+    }
+    if (len > slen - (start - 1))
+    {
+	len = slen - (start - 1);
+    }
+    return MakeLongString(&s->str[start - 1], len);
+}
+
+/* Return index of second string in first string */
+int __LStrIndex(const LongString* s, const LongString* sub)
+{
+    int slen = __LStrLength(s);
+    int sublen = __LStrLength(sub);
+    for (int i = 0; i < slen && i + sublen <= slen; i++)
+    {
+	if (!sublen || (s->str[i] == sub->str[0] && !memcmp(&s->str[i], sub->str, sublen)))
+	{
+	    return i + 1;
+	}
+    }
+    return 0;
+}
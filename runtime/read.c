@@ -502,6 +502,52 @@ void __read_S_str(String* str, String* v)
     readstr(intf, v);
 }
 
+static void readlstr(struct interface* intf, LongString** v)
+{
+    unsigned char buffer[256];
+    int           count = 0;
+
+    __LStrRelease(*v);
+    *v = NULL;
+    intf->fnpreread(intf);
+
+    while (!intf->fneoln(intf))
+    {
+	buffer[count++] = intf->fncurrent(intf);
+	if (count == sizeof(buffer))
+	{
+	    LongStringAppend(v, buffer, count);
+	    count = 0;
+	}
+	if (!intf->fngetnext(intf))
+	{
+	    break;
+	}
+    }
+    LongStringAppend(v, buffer, count);
+}
+
+void __read_lstr(File* file, LongString** v)
+{
+    if (file->handle >= MaxPascalFiles)
+    {
+	return;
+    }
+
+    struct interface intf;
+    initFile(file, &intf);
+
+    readlstr(&intf, v);
+}
+
+void __read_S_lstr(String* str, LongString** v)
+{
+    struct interface* intf = findInterface(str);
+    assert(intf && "Expected to find an interface");
+
+    readlstr(intf, v);
+}
+
 static void readchars(struct interface* intf, char* v)
 {
     intf->fnpreread(intf);
@@ -43,6 +43,17 @@ typedef struct
     unsigned char str[MaxStringLen + 1];
 } String;
 
+/* The heap block of a long string. A long string is a pointer to one of these, or NULL when empty.
+ * The compiler makes constant blocks with a negative refs, which are never changed or freed.
+ */
+typedef struct
+{
+    int           refs;
+    int           len;
+    int           size;
+    unsigned char str[];
+} LongString;
+
 struct TimeStamp
 {
     bool DateValid;
@@ -96,6 +107,9 @@ extern File output;
 void InitFiles();
 void SetupFile(File* f, int recSize, int isText);
 void FileError(const char* op);
+void __Panic(const char* msg);
+void LongStringAppend(LongString** s, const unsigned char* str, int len);
+void __LStrRelease(LongString* s);
 
 /*******************************************
  * File Basics, low level I/O.
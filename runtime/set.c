@@ -62,3 +62,32 @@ int __SetContains(Set* a, Set* b, int setWords)
     }
     return 1;
 }
+
+/* Number of elements in the set. */
+int __SetCard(Set* a, int setWords)
+{
+    int count = 0;
+    for (int i = 0; i < setWords; i++)
+    {
+	count += __builtin_popcount(a->v[i]);
+    }
+    return count;
+}
+
+/* Copy set src, whose first element is srcStart, to res, whose first element is resStart.
+ * Elements outside the range of res are dropped. */
+void __SetConvert(Set* res, int resStart, int resWords, Set* src, int srcStart, int srcWords)
+{
+    memset(res->v, 0, sizeof(res->v[0]) * resWords);
+    for (int i = 0; i < srcWords; i++)
+    {
+	for (unsigned w = src->v[i]; w; w &= w - 1)
+	{
+	    int n = srcStart + i * 32 + __builtin_ctz(w) - resStart;
+	    if (n >= 0 && n < resWords * 32)
+	    {
+		res->v[n >> 5] |= 1u << (n & 31);
+	    }
+	}
+    }
+}
@@ -198,6 +198,16 @@ void __write_str(File* file, const String* v, int width)
     }
 }
 
+void __write_S_lstr(String* str, const LongString* v, int width)
+{
+    __write_S_chars(str, v ? (const char*)v->str : "", v ? v->len : 0, width);
+}
+
+void __write_lstr(File* file, const LongString* v, int width)
+{
+    __write_chars(file, v ? (const char*)v->str : "", v ? v->len : 0, width);
+}
+
 void __write_S_enum(String* strout, int en, int width, struct EnumToString* e2s)
 {
     if (en < 0 || en > e2s->nelem)
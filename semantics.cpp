@@ -13,6 +13,7 @@ public:
 
 private:
     Types::TypeDecl* BinarySetUpdate(BinaryExprAST* b);
+    void             LongStringUpdate(BinaryExprAST* b);
     Types::TypeDecl* BinaryExprType(BinaryExprAST* b);
     template<typename T>
     void Check(T* t);
@@ -104,7 +105,7 @@ static Types::RangeDecl* GetRangeDecl(Types::TypeDecl* ty)
 
     if (r->Size() > Types::SetDecl::MaxSetSize)
     {
-	r = new Types::Range(0, Types::SetDecl::MaxSetSize - 1);
+	r = new Types::Range(0, Types::SetDecl::DefaultSetSize - 1);
     }
 
     return new Types::RangeDecl(r, base);
@@ -197,6 +198,19 @@ Types::TypeDecl* TypeCheckVisitor::BinarySetUpdate(BinaryExprAST* b)
     return rty;
 }
 
+// Either side may be a short string, char or character array, which is converted to a long string.
+void TypeCheckVisitor::LongStringUpdate(BinaryExprAST* b)
+{
+    Types::TypeDecl* ty = Types::Get<Types::LongStringDecl>();
+    if (!ty->CompatibleType(b->lhs->Type()) || !ty->CompatibleType(b->rhs->Type()))
+    {
+	Error(b, "Incompatible type for string operation");
+	return;
+    }
+    b->lhs = Recast(b->lhs, ty);
+    b->rhs = Recast(b->rhs, ty);
+}
+
 Types::TypeDecl* TypeCheckVisitor::BinaryExprType(BinaryExprAST* b)
 {
     Types::TypeDecl* lty = b->lhs->Type();
@@ -260,6 +274,11 @@ Types::TypeDecl* TypeCheckVisitor::BinaryExprType(BinaryExprAST* b)
 	    }
 	    return Types::Get<Types::BoolDecl>();
 	}
+	if (llvm::isa<Types::LongStringDecl>(lty) || llvm::isa<Types::LongStringDecl>(rty))
+	{
+	    LongStringUpdate(b);
+	    return Types::Get<Types::BoolDecl>();
+	}
 	if (llvm::isa<Types::StringDecl>(lty) || llvm::isa<Types::StringDecl>(rty))
 	{
 	    auto ty = Types::Get<Types::StringDecl>(255);
@@ -281,6 +300,11 @@ Types::TypeDecl* TypeCheckVisitor::BinaryExprType(BinaryExprAST* b)
 	break;
 
     case Token::Plus:
+	if (llvm::isa<Types::LongStringDecl>(lty) || llvm::isa<Types::LongStringDecl>(rty))
+	{
+	    LongStringUpdate(b);
+	    return Types::Get<Types::LongStringDecl>();
+	}
 	if (Types::IsStringLike(lty) && Types::IsStringLike(rty))
 	{
 	    return Types::Get<Types::StringDecl>(255);
@@ -675,6 +699,18 @@ void TypeCheckVisitor::Check<DynArrayExprAST>(DynArrayExprAST* d)
     }
 }
 
+template<>
+void TypeCheckVisitor::Check<LongStringIndexAST>(LongStringIndexAST* l)
+{
+    TRACE();
+
+    ExprAST* e = l->index;
+    if (!IsIntegral(e->Type()) || llvm::isa<Types::CharDecl>(e->Type()) || llvm::isa<RangeExprAST>(e))
+    {
+	Error(e, "Index should be an integral type");
+    }
+}
+
 template<>
 void TypeCheckVisitor::Check<BuiltinExprAST>(BuiltinExprAST* b)
 {
@@ -715,6 +751,11 @@ void TypeCheckVisitor::Check<CallExprAST>(CallExprAST* c)
 	    {
 		Error(c, "Expect variable for 'var' parameter");
 	    }
+	    else if (parg[idx].IsRef() && llvm::isa<Types::LongStringDecl>(parg[idx].Type()) !=
+	                                      llvm::isa<Types::LongStringDecl>(a->Type()))
+	    {
+		Error(c, "Incompatible string type for 'var' parameter");
+	    }
 	    else
 	    {
 		a = Recast(a, ty);
@@ -733,21 +774,26 @@ void TypeCheckVisitor::Check<CallExprAST>(CallExprAST* c)
 
 	    if (fnArg->Proto()->IsMatchWithoutClosure(argTy->Proto()))
 	    {
-		// Todo: Make this a function
-		std::vector<VariableExprAST*> vf;
-		FunctionAST*                  fn = fnArg->Proto()->Function();
-		Types::TypeDecl*              closureTy = fn->ClosureType();
-		for (auto u : fn->UsedVars())
+		FunctionAST* fn = fnArg->Proto()->Function();
+		ClosureAST*  closure = new ClosureAST(fn->Loc(), fn);
+		// Only a plain pointer, which has nowhere to keep the closure, needs a trampoline.
+		if (argTy->IsClosure())
+		{
+		    a = new FuncPtrAST(fnArg->loc, fnArg, closure, argTy);
+		}
+		else
 		{
-		    vf.push_back(new VariableExprAST(fn->Loc(), u.Name(), u.Type()));
+		    a = new TrampolineAST(fnArg->loc, fnArg, closure, argTy);
 		}
-		ClosureAST* closure = new ClosureAST(fn->Loc(), closureTy, vf);
-		a = new TrampolineAST(fnArg->loc, fnArg, closure, argTy);
 		bad = false;
 	    }
 	    else
 	    {
 		bad = !(*fnArg->Proto() == *argTy->Proto());
+		if (!bad && argTy->IsClosure())
+		{
+		    a = new FuncPtrAST(fnArg->loc, fnArg, 0, argTy);
+		}
 	    }
 	}
 	if (bad)
@@ -1107,6 +1153,7 @@ void TypeCheckVisitor::visit(ExprAST* expr)
     MaybeCheck<SetExprAST>(expr);
     MaybeCheck<ArrayExprAST>(expr);
     MaybeCheck<DynArrayExprAST>(expr);
+    MaybeCheck<LongStringIndexAST>(expr);
     MaybeCheck<BuiltinExprAST>(expr);
     MaybeCheck<CallExprAST>(expr);
     MaybeCheck<ForExprAST>(expr);
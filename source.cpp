@@ -1,33 +1,48 @@
 #include "source.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
-char FileSource::Get()
+void Source::SetText(const char* b, const char* e)
 {
-    char ch = input.get();
-    if (ch == '\n')
+    begin = b;
+    end = e;
+    lineStart.clear();
+    lineStart.push_back(0);
+    for (const char* p = b; (p = static_cast<const char*>(memchr(p, '\n', e - p))); p++)
     {
-	lineNo++;
-	lineStart[lineNo] = input.tellg();
-	column = 1;
+	lineStart.push_back(p + 1 - b);
     }
-    else
+}
+
+Location Source::Where(const char* pos) const
+{
+    uint32_t offset = pos - begin;
+    bool     nextLine = lastLine + 1 < lineStart.size() && offset >= lineStart[lastLine + 1];
+    if (offset < lineStart[lastLine] || nextLine)
     {
-	column++;
+	lastLine = std::upper_bound(lineStart.begin(), lineStart.end(), offset) - lineStart.begin() - 1;
     }
-    return ch;
+    return Location(name, lastLine + 1, offset - lineStart[lastLine] + 1);
 }
 
-void FileSource::PrintSource(uint32_t line)
+void Source::PrintSource(uint32_t line)
 {
-    std::fstream::pos_type here = input.tellg();
-    input.clear();
-    input.seekg(lineStart[line]);
+    if (line == 0 || line > lineStart.size())
+    {
+	return;
+    }
+    const char* p = begin + lineStart[line - 1];
+    const char* e = static_cast<const char*>(memchr(p, '\n', end - p));
+    std::cerr << std::string(p, e ? e : end) << std::endl;
+}
 
-    char ch;
-    while ((ch = input.get()) && ch != '\n' && input)
+// Large files are memory mapped, small ones read in one go.
+FileSource::FileSource(const std::string& name) : Source(name)
+{
+    if (auto buf = llvm::MemoryBuffer::getFile(name, false, false))
     {
-	std::cerr << ch;
+	buffer = std::move(*buf);
+	SetText(buffer->getBufferStart(), buffer->getBufferEnd());
     }
-    std::cerr << std::endl;
-    input.seekg(here);
 }
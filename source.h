@@ -3,35 +3,44 @@
 
 #include "location.h"
 #include <cstdint>
-#include <fstream>
-#include <map>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
 #include <string>
+#include <vector>
 
+// The whole text of a source is in memory, and the lexer scans it directly. Locations are worked
+// out from the offset when asked for, using a table of where each line starts.
 class Source
 {
 public:
     virtual ~Source() {}
-    virtual char Get() = 0;
     virtual operator bool() const = 0;
-    virtual operator Location() const = 0;
-    virtual void PrintSource(uint32_t line) {}
+    const char*  Begin() const { return begin; }
+    const char*  End() const { return end; }
+    Location     Where(const char* pos) const;
+    virtual void PrintSource(uint32_t line);
+
+protected:
+    Source(const std::string& name) : name(name), begin(0), end(0), lineStart{ 0 }, lastLine(0) {}
+    void SetText(const char* b, const char* e);
+
+private:
+    std::string           name;
+    const char*           begin;
+    const char*           end;
+    std::vector<uint32_t> lineStart;
+    // Tokens are asked for in order, so the next lookup is most likely on the same line.
+    mutable size_t lastLine;
 };
 
 class FileSource : public Source
 {
 public:
-    FileSource(const std::string& name) : name(name), input(name), column(1), lineNo(1) { lineStart[1] = 0; }
-    char Get() override;
-    operator bool() const override { return (bool)input; }
-    operator Location() const override { return Location(name, lineNo, column); }
-    void PrintSource(uint32_t line) override;
+    FileSource(const std::string& name);
+    operator bool() const override { return buffer != nullptr; }
 
 private:
-    std::string                                name;
-    std::ifstream                              input;
-    uint32_t                                   column;
-    uint32_t                                   lineNo;
-    std::map<uint32_t, std::fstream::pos_type> lineStart;
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
 };
 
 #endif
@@ -1,11 +1,12 @@
 #ifndef STACK_H
 #define STACK_H
 
+#include "ident.h"
 #include "namedobject.h"
 #include "options.h"
 #include "utils.h"
-#include <deque>
 #include <iostream>
+#include <llvm/ADT/DenseMap.h>
 #include <map>
 #include <string>
 #include <vector>
@@ -18,86 +19,87 @@ public:
     typedef std::map<std::string, T> MapType;
 
 private:
-    using MapIter = typename MapType::const_iterator;
-    using StackType = std::deque<MapType>;
-    using StackRIter = typename StackType::const_reverse_iterator;
+    // Each name has a chain of its definitions, innermost last, so a lookup is a single hash probe.
+    struct Definition
+    {
+	size_t level;
+	T      value;
+    };
+    using Chain = std::vector<Definition>;
 
 public:
-    Stack() { NewLevel(); }
-    void NewLevel() { stack.push_back(MapType()); }
+    // The definitions made at each level, in order, to unwind the chains when the level is dropped.
+    using Level = std::vector<std::pair<Ident, T>>;
 
-    size_t MaxLevel() const { return stack.size() - 1; }
+    Stack() { NewLevel(); }
+    void NewLevel() { levels.push_back({}); }
 
-    const MapType& GetLevel() { return stack.back(); }
+    size_t MaxLevel() const { return levels.size() - 1; }
 
-    void DropLevel() { stack.pop_back(); }
+    const Level& GetLevel() const { return levels.back(); }
+    const Level& GetLevel(size_t level) const { return levels[level]; }
 
-    static void LowerIfNeeded(std::string& name)
+    void DropLevel()
     {
-	if (caseInsensitive)
+	for (auto& d : levels.back())
 	{
-	    strlower(name);
+	    symbols[d.first].pop_back();
 	}
+	levels.pop_back();
     }
 
     /* Returns false on failure */
-    bool Add(std::string name, const T& v)
+    bool Add(Ident name, const T& v)
     {
-	LowerIfNeeded(name);
-	const auto [it, inserted] = stack.back().insert({ name, v });
-	if (verbosity > 1 && inserted)
+	Chain& chain = symbols[name];
+	if (!chain.empty() && chain.back().level == MaxLevel())
 	{
-	    std::cerr << "Adding value: " << name << std::endl;
+	    return false;
 	}
-	return inserted;
+	chain.push_back({ MaxLevel(), v });
+	levels.back().push_back({ name, v });
+	if (verbosity > 1)
+	{
+	    std::cerr << "Adding value: " << *name << std::endl;
+	}
+	return true;
     }
+    bool Add(const std::string& name, const T& v) { return Add(Intern(name), v); }
     // Alternative version, used with NamedObject
     bool Add(const T& v) { return Add(v->Name(), v); }
 
-    T Find(std::string name) const
+    T Find(Ident name) const
     {
-	if (verbosity > 1)
+	if (const Definition* d = Innermost(name))
 	{
-	    std::cerr << "Finding value: " << name << std::endl;
-	}
-	LowerIfNeeded(name);
-	for (StackRIter s = stack.rbegin(); s != stack.rend(); s++)
-	{
-	    if (MapIter it = s->find(name); it != s->end())
-	    {
-		if (verbosity > 1)
-		{
-		    std::cerr << "Found it" << std::endl;
-		}
-		return it->second;
-	    }
+	    return d->value;
 	}
 	if (verbosity > 1)
 	{
-	    std::cerr << "Not found " << name << std::endl;
+	    std::cerr << "Not found " << *name << std::endl;
 #if !NDEBUG
 	    dump();
 #endif
 	}
 	return 0;
     }
+    T Find(const std::string& name) const { return Find(Intern(name)); }
 
-    T FindTopLevel(std::string name)
+    T FindTopLevel(const std::string& name) const
     {
-	LowerIfNeeded(name);
-	if (auto it = stack.back().find(name); it != stack.back().end())
+	if (const Definition* d = Innermost(Intern(name)); d && d->level == MaxLevel())
 	{
-	    return it->second;
+	    return d->value;
 	}
 	return 0;
     }
 
-    T FindBaseLevel(std::string name)
+    T FindBaseLevel(const std::string& name) const
     {
-	LowerIfNeeded(name);
-	if (auto it = stack.front().find(name); it != stack.front().end())
+	auto it = symbols.find(Intern(name));
+	if (it != symbols.end() && !it->second.empty() && it->second.front().level == 0)
 	{
-	    return it->second;
+	    return it->second.front().value;
 	}
 	return 0;
     }
@@ -105,7 +107,18 @@ public:
     void dump() const;
 
 private:
-    StackType stack;
+    const Definition* Innermost(Ident name) const
+    {
+	auto it = symbols.find(name);
+	if (it == symbols.end() || it->second.empty())
+	{
+	    return 0;
+	}
+	return &it->second.back();
+    }
+
+    llvm::DenseMap<Ident, Chain> symbols;
+    std::vector<Level>           levels;
 };
 
 template<typename T>
@@ -123,14 +136,12 @@ private:
 template<typename T>
 void Stack<T>::dump() const
 {
-    int n = 0;
-    for (auto s : stack)
+    for (size_t n = 0; n <= MaxLevel(); n++)
     {
 	std::cerr << "Level " << n << std::endl;
-	n++;
-	for (auto v : s)
+	for (auto& v : GetLevel(n))
 	{
-	    std::cerr << v.first << ": ";
+	    std::cerr << *v.first << ": ";
 	    v.second->dump();
 	    std::cerr << std::endl;
 	}
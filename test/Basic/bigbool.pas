@@ -0,0 +1,66 @@
+program bigbool;
+
+{ The same as bigset.pas, with the sets written as arrays of boolean, as they had to be
+  before sets could be this large. "make setbench" times the two against each other. }
+
+type
+   bigrange = 0..65535;
+   bigset   = array [bigrange] of boolean;
+
+var
+   evens, threes, all, both, wide : bigset;
+   i, r, count, last		  : integer;
+   unions, lookups, iters	  : integer;
+
+function Card(var s : bigset) : integer;
+var
+   i, n : integer;
+begin
+   n := 0;
+   for i := 0 to 65535 do
+      if s[i] then
+	 n := n + 1;
+   Card := n;
+end;
+
+begin
+   read(unions, lookups, iters);
+   for i := 0 to 65535 do
+   begin
+      evens[i] := false;
+      threes[i] := false;
+   end;
+   for i := 0 to 32767 do
+      evens[i * 2] := true;
+   for i := 0 to 21845 do
+      threes[i * 3] := true;
+
+   for r := 1 to unions do
+      for i := 0 to 65535 do
+	 all[i] := evens[i] or threes[i];
+   writeln('card(all)=', Card(all));
+
+   count := 0;
+   for r := 1 to lookups do
+      for i := 0 to 65535 do
+	 if all[i] then
+	    count := count + 1;
+   writeln('members=', count);
+
+   for i := 0 to 65535 do
+      both[i] := evens[i] and threes[i];
+   count := 0;
+   last := 0;
+   for r := 1 to iters do
+      for i := 0 to 65535 do
+	 if both[i] then
+	 begin
+	    count := count + 1;
+	    last := i;
+	 end;
+   writeln('iterated=', count, ' last=', last);
+
+   wide := evens;
+   wide[1099] := true;
+   writeln('card(wide)=', Card(wide), ' ', wide[1099], ' ', wide[1101]);
+end.
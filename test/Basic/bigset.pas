@@ -0,0 +1,48 @@
+program bigset;
+
+{ Sets of 64K elements. Reads how many times to repeat the union, membership and
+  iteration loops, so that "make setbench" can time each of them. }
+
+type
+   bigrange = 0..65535;
+   bigset   = set of bigrange;
+
+var
+   evens, threes, all, both, wide : bigset;
+   i, r, count, last		  : integer;
+   unions, lookups, iters	  : integer;
+
+begin
+   read(unions, lookups, iters);
+   evens := [];
+   threes := [];
+   for i := 0 to 32767 do
+      evens := evens + [i * 2];
+   for i := 0 to 21845 do
+      threes := threes + [i * 3];
+
+   for r := 1 to unions do
+      all := evens + threes;
+   writeln('card(all)=', card(all));
+
+   count := 0;
+   for r := 1 to lookups do
+      for i := 0 to 65535 do
+	 if i in all then
+	    count := count + 1;
+   writeln('members=', count);
+
+   both := evens * threes;
+   count := 0;
+   last := 0;
+   for r := 1 to iters do
+      for i in both do
+      begin
+	 count := count + 1;
+	 last := i;
+      end;
+   writeln('iterated=', count, ' last=', last);
+
+   wide := evens + [1099];
+   writeln('card(wide)=', card(wide), ' ', 1099 in wide, ' ', 1101 in wide);
+end.
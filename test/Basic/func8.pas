@@ -0,0 +1,59 @@
+program func8;
+
+(* Nested procedures with access to outer variables, passed as procedural parameters *)
+
+procedure apply(procedure p(x : integer); n : integer);
+var
+   i : integer;
+begin
+   for i := 1 to n do
+      p(i);
+end; { apply }
+
+procedure pass(procedure p(x : integer); n : integer);
+begin
+   apply(p, n);
+end; { pass }
+
+function sum(function f(x : integer) : integer; n : integer) : integer;
+var
+   i, s : integer;
+begin
+   s := 0;
+   for i := 1 to n do
+      s := s + f(i);
+   sum := s;
+end; { sum }
+
+function square(x : integer) : integer;
+begin
+   square := x * x;
+end; { square }
+
+procedure outer(scale : integer);
+var
+   total : integer;
+
+   procedure add(x : integer);
+   begin
+      total := total + x * scale;
+   end; { add }
+
+   function scaled(x : integer) : integer;
+   begin
+      scaled := x * scale;
+   end; { scaled }
+
+begin
+   total := 0;
+   apply(add, 4);
+   writeln('total=', total:4);
+   pass(add, 3);
+   writeln('total=', total:4);
+   writeln('sum=', sum(scaled, 5):4);
+end; { outer }
+
+begin
+   outer(3);
+   writeln('squares=', sum(square, 4):4);
+end.
@@ -0,0 +1,48 @@
+program func9;
+
+(* Procedures taking records of different sizes by value, passed as procedural parameters *)
+
+type
+   small = record
+	      a : integer;
+	   end;
+   large = record
+	      a : integer;
+	      b : array [1..100] of integer;
+	      c : integer;
+	   end;
+
+procedure callsmall(procedure p(r : small); r : small);
+begin
+   p(r);
+end; { callsmall }
+
+procedure calllarge(procedure p(r : large); r : large);
+begin
+   p(r);
+end; { calllarge }
+
+procedure showsmall(r : small);
+begin
+   writeln('small=', r.a:4);
+end; { showsmall }
+
+procedure showlarge(r : large);
+begin
+   writeln('large=', r.a:4, r.b[100]:4, r.c:4);
+end; { showlarge }
+
+var
+   s : small;
+   l : large;
+   i : integer;
+
+begin
+   s.a := 7;
+   l.a := 1;
+   for i := 1 to 100 do
+      l.b[i] := i;
+   l.c := 42;
+   callsmall(showsmall, s);
+   calllarge(showlarge, l);
+end.
@@ -0,0 +1,41 @@
+program inline2;
+
+var
+   hot   : integer;
+   total : integer;
+
+function square(x : integer) : integer; inline;
+begin
+   square := x * x;
+end; { square }
+
+procedure report(msg : string); noinline; cold;
+begin
+   writeln('Report: ', msg);
+end; { report }
+
+function sumsquares(n : integer) : integer; hot; flatten;
+var
+   i, s : integer;
+
+   procedure add(v : integer); inline;
+   begin
+      s := s + square(v);
+   end; { add }
+
+begin
+   s := 0;
+   for i := 1 to n do
+      add(i);
+   sumsquares := s;
+end; { sumsquares }
+
+begin
+   hot := 10;
+   total := sumsquares(hot);
+   writeln('Sum of squares=', total:5);
+   if total <> 385 then
+      report('wrong sum')
+   else
+      report('ok');
+end.
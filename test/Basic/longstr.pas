@@ -0,0 +1,72 @@
+program longstr;
+
+{ Strings of type ansistring, which aren't limited to 255 characters. }
+
+var
+   s, t	: ansistring;
+   line	: ansistring;
+   sstr	: string;
+   i	: integer;
+
+function Repeated(c : char; n : integer) : ansistring;
+var
+   r : ansistring;
+   i : integer;
+begin
+   r := '';
+   for i := 1 to n do
+      r := r + c;
+   Repeated := r;
+end;
+
+{ Changes only the copy passed in. }
+function Shout(x : ansistring) : ansistring;
+begin
+   x := x + '!';
+   Shout := x;
+end;
+
+procedure Exclaim(var x : ansistring);
+begin
+   x := x + '!';
+end;
+
+begin
+   s := '';
+   for i := 1 to 1000 do
+      s := s + chr(ord('a') + i mod 26);
+   writeln(length(s));
+   writeln(s[1], s[26], s[1000]);
+
+   { Changing a copy doesn't change the original. }
+   t := s;
+   t[1] := 'X';
+   writeln(s[1], t[1]);
+   writeln(s = t, ' ', s > t);
+   t[1] := 'b';
+   writeln(s = t);
+
+   { Conversion to and from short strings. }
+   sstr := s;
+   writeln(length(sstr));
+   sstr := 'Hello';
+   t := sstr + ', ' + 'World';
+   writeln(t, ' ', length(t));
+
+   t := s + s;
+   writeln(length(t));
+   writeln(copy(t, 999, 4));
+   writeln(index(t, 'mbc'));
+   writeln(index(t, 'zzz'));
+
+   t := Repeated('x', 300);
+   writeln(length(t), ' ', t[300]);
+   writeln(Shout('Hi'), ' ', length(Shout(t)));
+   writeln(length(t));
+   Exclaim(t);
+   writeln(length(t), ' ', t[301]);
+
+   { A line longer than a short string. }
+   readln(line);
+   writeln(length(line), ' ', copy(line, length(line) - 4, 5));
+end.
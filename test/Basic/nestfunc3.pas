@@ -0,0 +1,106 @@
+program nestfunc3;
+
+{ n and scale are only read by the nested functions. }
+procedure matrix(n, scale : integer);
+
+var
+   i     : integer;
+   total : integer;
+
+   function cell(r, c : integer) : integer;
+   begin
+      cell := (r * n + c) * scale;
+   end;
+
+   procedure row(r : integer);
+   var
+      k : integer;
+   begin
+      for k := 1 to n do
+	 total := total + cell(r, k);
+   end;
+
+begin
+   total := 0;
+   for i := 1 to n do
+      row(i);
+   writeln('total=', total:1);
+end;
+
+{ count is written by bump, which show calls. }
+procedure counter;
+
+var
+   count : integer;
+
+   procedure bump;
+   begin
+      count := count + 1;
+   end;
+
+   procedure show;
+   begin
+      bump;
+      writeln('count=', count:1);
+   end;
+
+begin
+   count := 10;
+   show;
+   show;
+end;
+
+{ limit is written through the var parameter l while report runs. }
+procedure alias;
+
+var
+   limit : integer;
+
+   procedure change(var l : integer);
+
+      procedure report;
+      begin
+	 writeln('limit=', limit:1);
+	 l := l + 1;
+	 writeln('limit=', limit:1);
+      end;
+
+   begin
+      l := 5;
+      report;
+   end;
+
+begin
+   limit := 0;
+   change(limit);
+end;
+
+{ step is written by apply, while it holds on to next. }
+procedure holder;
+
+var
+   step : integer;
+
+   function next(x : integer) : integer;
+   begin
+      next := x + step;
+   end;
+
+   procedure apply(function f(x : integer) : integer);
+   begin
+      writeln('apply=', f(1):1);
+      step := 100;
+      writeln('apply=', f(1):1);
+   end;
+
+begin
+   step := 1;
+   apply(next);
+end;
+
+begin
+   matrix(3, 2);
+   counter;
+   alias;
+   holder;
+end.
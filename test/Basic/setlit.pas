@@ -0,0 +1,60 @@
+program setlit;
+
+{ Set literals with elements and ranges only known at runtime, mixed with constant ones. }
+
+type
+   small = set of 0..31;
+   large = set of 0..999;
+
+var
+   s	     : small;
+   c	     : set of char;
+   l	     : large;
+   lo, hi, x : integer;
+   i	     : integer;
+   ch, ch2   : char;
+
+begin
+   lo := 3;
+   hi := 9;
+   x := 30;
+   s := [lo..hi, x, 1, 20..21];
+   for i := 0 to 31 do
+      if i in s then
+	 write(i:4);
+   writeln;
+
+   { An empty range adds nothing. }
+   lo := 9;
+   hi := 3;
+   s := [lo..hi, x];
+   for i := 0 to 31 do
+      if i in s then
+	 write(i:4);
+   writeln;
+
+   ch := 'd';
+   ch2 := 'h';
+   c := [ch..ch2, 'x', '0'..'2', ch2];
+   for ch in c do
+      write(ch);
+   writeln;
+
+   lo := 30;
+   hi := 970;
+   x := 999;
+   l := [lo..hi, x, 5, 990..992];
+   writeln(card(l), ' ', 29 in l, ' ', 30 in l, ' ', 970 in l, ' ', 971 in l, ' ', 999 in l, ' ',
+	   5 in l, ' ', 991 in l);
+
+   { Exactly one whole word. }
+   lo := 64;
+   hi := 95;
+   l := [lo..hi];
+   writeln(card(l), ' ', 63 in l, ' ', 64 in l, ' ', 95 in l, ' ', 96 in l);
+
+   lo := 100;
+   hi := 101;
+   l := [lo..hi, x];
+   writeln(card(l));
+end.
@@ -0,0 +1,60 @@
+program setops;
+
+{ Operations on sets of one word, two words and eight words. Reads the number of rounds,
+  so that "make setopbench" can time it. }
+
+type
+   small  = set of 0..31;
+   medium = set of 0..63;
+   chars  = set of char;
+
+var
+   a, b, x	     : small;
+   c, d, y	     : medium;
+   e, f, z	     : chars;
+   i, r, sum, rounds : integer;
+   ch		     : char;
+
+begin
+   read(rounds);
+   sum := 0;
+   for r := 1 to rounds do
+      for i := 0 to 63 do
+      begin
+	 a := [i mod 32, (i * 7) mod 32];
+	 b := [(i * 3) mod 32..31];
+	 c := [i, (i * 5) mod 64];
+	 d := [i div 2..63];
+	 ch := chr(ord('a') + i mod 26);
+	 e := ['a'..ch];
+	 f := [ch..'z', 'A'..'Z'];
+
+	 sum := sum + card(a + b) + card(a * b) + card(a - b) + card(a >< b);
+	 sum := sum + card(c + d) + card(c * d) + card(c - d) + card(c >< d);
+	 sum := sum + card(e + f) + card(e * f) + card(e - f) + card(e >< f);
+
+	 x := (a + b) - (a * b);
+	 y := (c + d) - (c * d);
+	 z := (e + f) - (e * f);
+	 if x = a >< b then
+	    sum := sum + 1;
+	 if y = c >< d then
+	    sum := sum + 2;
+	 if z = e >< f then
+	    sum := sum + 3;
+
+	 if a <= b then
+	    sum := sum + 5;
+	 if c <= d then
+	    sum := sum + 7;
+	 if e <= f then
+	    sum := sum + 11;
+	 if b >= a then
+	    sum := sum + 13;
+	 if d <> c then
+	    sum := sum + 17;
+	 if f = e then
+	    sum := sum + 19;
+      end;
+   writeln('sum=', sum);
+end.
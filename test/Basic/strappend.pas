@@ -0,0 +1,35 @@
+program strappend;
+
+{ Build a line of 50 words, with a short string and with an ansistring, and keep a copy of each
+  line. Reads the number of rounds to do for each. }
+
+var
+   shortRounds, longRounds : integer;
+   r, i, total		   : integer;
+   ss, sscopy		   : string;
+   ls, lscopy		   : ansistring;
+
+begin
+   readln(shortRounds, longRounds);
+   total := 0;
+   for r := 1 to shortRounds do
+   begin
+      ss := '';
+      for i := 1 to 50 do
+	 ss := ss + 'word ';
+      sscopy := ss;
+      total := total + length(sscopy);
+   end;
+   writeln(total);
+
+   total := 0;
+   for r := 1 to longRounds do
+   begin
+      ls := '';
+      for i := 1 to 50 do
+	 ls := ls + 'word ';
+      lscopy := ls;
+      total := total + length(lscopy);
+   end;
+   writeln(total);
+end.
@@ -0,0 +1,86 @@
+program tokens;
+
+{ Counts identifiers in generated text, with the character classes written as set literals
+  that have both constant and variable parts. Reads how many rounds to run with the literal
+  in the test, and with the set built into a variable first, so that "make tokenbench" can
+  time each of them. }
+
+const
+   textLen = 10000;
+
+var
+   buf		    : array [1..textLen] of char;
+   alphabet	    : string;
+   lo, hi, sep	    : char;
+   i, r, seed, n    : integer;
+   literal, built   : integer;
+   nLiteral, nBuilt : integer;
+
+function CountLiteral : integer;
+var
+   i, n	   : integer;
+   inIdent : boolean;
+begin
+   n := 0;
+   inIdent := false;
+   for i := 1 to textLen do
+      if buf[i] in [lo..hi, 'A'..'Z', sep] then
+      begin
+	 if not inIdent then
+	    n := n + 1;
+	 inIdent := true;
+      end
+      else if not (inIdent and (buf[i] in ['0'..'9'])) then
+	 inIdent := false;
+   CountLiteral := n;
+end; { CountLiteral }
+
+function CountBuilt : integer;
+var
+   i, n	   : integer;
+   inIdent : boolean;
+   s	   : set of char;
+begin
+   n := 0;
+   inIdent := false;
+   for i := 1 to textLen do
+   begin
+      s := [lo..hi, 'A'..'Z', sep];
+      if buf[i] in s then
+      begin
+	 if not inIdent then
+	    n := n + 1;
+	 inIdent := true;
+      end
+      else
+      begin
+	 s := ['0'..'9'];
+	 if not (inIdent and (buf[i] in s)) then
+	    inIdent := false;
+      end;
+   end;
+   CountBuilt := n;
+end; { CountBuilt }
+
+begin
+   read(literal, built);
+   alphabet := 'abcxyzABCXYZ_0189 +-*;()';
+   seed := 1;
+   n := length(alphabet);
+   for i := 1 to textLen do
+   begin
+      seed := (seed * 1103 + 12345) mod 65536;
+      buf[i] := alphabet[seed mod n + 1];
+   end;
+   lo := 'a';
+   hi := 'z';
+   sep := '_';
+
+   nLiteral := 0;
+   for r := 1 to literal do
+      nLiteral := nLiteral + CountLiteral;
+   nBuilt := 0;
+   for r := 1 to built do
+      nBuilt := nBuilt + CountBuilt;
+   writeln('literal=', nLiteral, ' built=', nBuilt);
+end.
@@ -0,0 +1,14 @@
+program tm;
+
+uses unit_file, unit_file2;
+
+var
+   v :  uutype;
+
+begin
+   v := 18;
+   writeln(uui:5);
+   uufoo(v);
+   writeln(uui:5);
+   pp;
+end.
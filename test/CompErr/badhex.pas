@@ -0,0 +1,8 @@
+program badhex;
+
+var
+   x : integer;
+
+begin
+   x := $FFFFFFFFFFFFFFFFFFFF;
+end.
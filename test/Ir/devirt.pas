@@ -0,0 +1,51 @@
+program devirt;
+
+type
+   shape  = object
+	       w, h : integer;
+	       function area : integer; virtual; noinline;
+	       function kind : integer; virtual; noinline;
+	    end;
+
+   square = object(shape)
+	       function kind : integer; override; noinline;
+	    end;
+
+function shape.area : integer;
+begin
+   area := w * h;
+end;
+
+function shape.kind : integer;
+begin
+   kind := 1;
+end;
+
+function square.kind : integer;
+begin
+   kind := 2;
+end;
+
+{ Neither class overrides area, so this calls shape.area directly. }
+function total(var s : shape) : integer; noinline;
+begin
+   total := s.area;
+end;
+
+{ Either kind may be called, so both are called directly after checking the vtable. }
+function describe(var s : shape) : integer; noinline;
+begin
+   describe := s.kind * 10;
+end;
+
+var
+   s : shape;
+   q : square;
+
+begin
+   s.w := 3;
+   s.h := 4;
+   q.w := 2;
+   q.h := 5;
+   writeln(total(s), total(q), describe(s), describe(q));
+end.
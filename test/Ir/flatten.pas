@@ -0,0 +1,23 @@
+program flatten;
+
+function twice(x : integer) : integer;
+begin
+   twice := x * 2;
+end;
+
+{ Writes, so that the call can't be removed. }
+function helper(x : integer) : integer; noinline;
+begin
+   writeln('helper ', x);
+   helper := x + 1;
+end;
+
+{ Flattening inlines twice, but helper is noinline, so it is still called. }
+function flat(x : integer) : integer; noinline; flatten;
+begin
+   flat := helper(twice(x));
+end;
+
+begin
+   writeln(flat(5));
+end.
@@ -0,0 +1,61 @@
+program hoist;
+
+type
+   { Large enough to use the runtime rather than be operated on as a value. }
+   bigset = set of 0..1023;
+
+var
+   s, t	: string;
+   a, b	: bigset;
+
+function strequal(var x, y : string) : integer; noinline;
+var
+   i, count : integer;
+begin
+   count := 0;
+   for i := 1 to 100 do
+      if x = y then
+	 count := count + 1;
+   strequal := count;
+end; { strequal }
+
+function strless(var x, y : string) : integer; noinline;
+var
+   i, count : integer;
+begin
+   count := 0;
+   for i := 1 to 100 do
+      if x < y then
+	 count := count + i;
+   strless := count;
+end; { strless }
+
+function setequal(var x, y : bigset) : integer; noinline;
+var
+   i, count : integer;
+begin
+   count := 0;
+   for i := 1 to 100 do
+      if x = y then
+	 count := count + 1;
+   setequal := count;
+end; { setequal }
+
+function subset(var x, y : bigset) : integer; noinline;
+var
+   i, count : integer;
+begin
+   count := 0;
+   for i := 1 to 100 do
+      if x <= y then
+	 count := count + i;
+   subset := count;
+end; { subset }
+
+begin
+   s := 'hello';
+   t := 'world';
+   a := [1..6];
+   b := [1..26];
+   writeln(strequal(s, t), strless(s, t), setequal(a, b), subset(a, b));
+end.
@@ -0,0 +1,4 @@
+card(all)=43691
+members=43691
+iterated=10923 last=65532
+card(wide)=32769 TRUE FALSE
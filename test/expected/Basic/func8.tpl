@@ -0,0 +1,4 @@
+total=  30
+total=  48
+sum=  45
+squares=  30
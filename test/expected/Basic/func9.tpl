@@ -0,0 +1,2 @@
+small=   7
+large=   1 100  42
@@ -0,0 +1,2 @@
+Sum of squares=  385
+Report: ok
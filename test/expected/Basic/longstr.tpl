@@ -0,0 +1,16 @@
+1000
+bam
+bX
+FALSE TRUE
+TRUE
+255
+Hello, World 12
+2000
+lmbc
+1000
+0
+300 x
+Hi! 301
+300
+301 !
+400 56789
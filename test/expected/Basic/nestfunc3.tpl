@@ -0,0 +1,7 @@
+total=144
+count=11
+count=12
+limit=5
+limit=6
+apply=2
+apply=101
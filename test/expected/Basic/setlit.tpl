@@ -0,0 +1,6 @@
+   1   3   4   5   6   7   8   9  20  21  30
+  30
+012defghx
+946 FALSE TRUE TRUE FALSE TRUE TRUE TRUE
+32 FALSE TRUE TRUE FALSE
+3
@@ -0,0 +1 @@
+sum=18123
@@ -0,0 +1,2 @@
+25000
+25000
@@ -0,0 +1 @@
+literal=1485 built=1485
@@ -0,0 +1,4 @@
+    9
+Hello from a unit
+   25
+good
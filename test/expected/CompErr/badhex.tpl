@@ -0,0 +1 @@
+CompErr/badhex.pas:7:11: Error: Invalid assignment
@@ -0,0 +1 @@
+total P.shape$area
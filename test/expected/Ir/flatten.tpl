@@ -0,0 +1 @@
+flat P.helper
@@ -0,0 +1,4 @@
+strequal __StrCompare
+strless __StrCompare
+setequal __SetEqual
+subset __SetContains
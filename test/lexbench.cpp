@@ -0,0 +1,81 @@
+// Lexer throughput.
+//
+// Generates a Pascal source of several megabytes, with a mix of identifiers, keywords, numbers,
+// strings and comments, and reports how fast the lexer turns it into tokens, in MB/s.
+// Built by "make lexbench" in the top directory, as it uses the compiler's own lexer.
+
+#include "../lexer.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+int  verbosity;
+bool caseInsensitive = true;
+
+const int   numProcs = 20000;
+const int   repeats = 5;
+const char* fileName = "lexbench.pas";
+
+static size_t Generate()
+{
+    std::ofstream out(fileName);
+    out << "program lexbench;\n\nvar\n   Total : integer;\n   Name  : string;\n\n";
+    for (int i = 0; i < numProcs; i++)
+    {
+	out << "{ Procedure number " << i << ", which does some arithmetic. }\n"
+	    << "procedure Proc" << i << "(a, b : integer; var c : real);\n"
+	    << "var\n   i, Count : integer;\n   x : array [1..10] of real;\n"
+	    << "begin\n"
+	    << "   Count := 0;\n"
+	    << "   for i := 1 to 10 do\n"
+	    << "   begin\n"
+	    << "      x[i] := (a * i + b) / 3.14159e0; (* Scale it *)\n"
+	    << "      if (x[i] >= 2.5) and (i <> " << i % 10 << ") then\n"
+	    << "         Count := Count + $" << std::hex << i << std::dec << ";\n"
+	    << "   end;\n"
+	    << "   c := x[1] + x[10];\n"
+	    << "   Name := 'Proc" << i << " isn''t done';\n"
+	    << "   Total := Total + Count // Running total\n"
+	    << "end;\n\n";
+    }
+    out << "begin\n   Total := 0;\n   writeln(Total)\nend.\n";
+    return out.tellp();
+}
+
+int main()
+{
+    size_t size = Generate();
+    double best = 0;
+    size_t tokens = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+	auto       start = std::chrono::steady_clock::now();
+	FileSource source(fileName);
+	if (!source)
+	{
+	    std::cerr << "Could not open " << fileName << std::endl;
+	    return 1;
+	}
+	Lexer lexer(source);
+	tokens = 0;
+	while (lexer.GetToken().GetToken() != Token::EndOfFile)
+	{
+	    tokens++;
+	}
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (r == 0 || t < best)
+	{
+	    best = t;
+	}
+    }
+    std::remove(fileName);
+
+    std::cout << std::fixed << std::setprecision(2) << "size:   " << std::setw(10) << size / 1e6 << " MB\n"
+              << "tokens: " << std::setw(10) << tokens / 1e6 << " M\n"
+              << "time:   " << std::setw(10) << best * 1000 << " ms\n"
+              << "lexing: " << std::setw(10) << size / best / 1e6 << " MB/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,327 @@
+// Compile time scalability benchmark.
+//
+// Generates Pascal programs that grow along one dimension at a time, compiles each of them at
+// -O0 to -O3 with -tt, and writes the time of each compiler phase and the peak RSS as JSON.
+// Phases whose time grows clearly faster than the size of the program are reported, and make
+// the benchmark fail.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+std::string compiler = "../lacsap";
+std::string workDir = "Scale";
+
+// A phase has to take at least this long to be checked for super-linear growth, to avoid noise.
+const double minCheckTime = 10.0;
+// Flag growth when time grows more than this factor above the growth of the size.
+const double growthMargin = 1.5;
+
+struct Result
+{
+    std::string                   dimension;
+    int                           size;
+    std::string                   opt;
+    std::map<std::string, double> phases;
+    long                          peakRss;
+};
+
+struct Dimension
+{
+    std::string                                         name;
+    std::vector<int>                                    sizes;
+    std::function<void(const std::string& base, int n)> generate;
+};
+
+static void WriteFile(const std::string& name, const std::string& text)
+{
+    std::ofstream out(name);
+    out << text;
+}
+
+// Many small procedures, all called from the main program.
+static void GenProcs(const std::string& base, int n)
+{
+    std::stringstream ss;
+    ss << "program procs;\nvar\n   total : integer;\n";
+    for (int i = 0; i < n; i++)
+    {
+	ss << "procedure p" << i << "(x : integer);\nvar\n   y : integer;\nbegin\n   y := x * 2 + " << i
+	   << ";\n   total := total + y\nend;\n";
+    }
+    ss << "begin\n   total := 0;\n";
+    for (int i = 0; i < n; i++)
+    {
+	ss << "   p" << i << "(" << i << ");\n";
+    }
+    ss << "   writeln(total)\nend.\n";
+    WriteFile(base + ".pas", ss.str());
+}
+
+// Procedures nested n deep, where the innermost uses the variables of all the outer ones.
+static void GenNesting(const std::string& base, int n)
+{
+    std::stringstream ss;
+    ss << "program nesting;\nvar\n   total : integer;\n";
+    for (int i = 0; i < n; i++)
+    {
+	std::string indent(i * 3, ' ');
+	ss << indent << "procedure l" << i << "(a : integer);\n"
+	   << indent << "var\n"
+	   << indent << "   v" << i << " : integer;\n";
+    }
+    for (int i = n - 1; i >= 0; i--)
+    {
+	std::string indent(i * 3, ' ');
+	ss << indent << "begin\n" << indent << "   v" << i << " := a + 1;\n";
+	if (i == n - 1)
+	{
+	    ss << indent << "   total := total";
+	    for (int j = 0; j < n; j++)
+	    {
+		ss << " + v" << j;
+	    }
+	    ss << ";\n";
+	}
+	else
+	{
+	    ss << indent << "   l" << i + 1 << "(v" << i << ");\n";
+	}
+	ss << indent << "end;\n";
+    }
+    ss << "begin\n   total := 0;\n   l0(1);\n   writeln(total)\nend.\n";
+    WriteFile(base + ".pas", ss.str());
+}
+
+// A record with n fields plus an n element array, copied by value.
+static void GenRecord(const std::string& base, int n)
+{
+    std::stringstream ss;
+    ss << "program rec;\ntype\n   r = record\n";
+    for (int i = 0; i < n; i++)
+    {
+	ss << "      f" << i << " : integer;\n";
+    }
+    ss << "      a : array [1.." << n << "] of integer;\n   end;\nvar\n   x : r;\n";
+    ss << "procedure p(v : r);\nvar\n   y : r;\nbegin\n   y := v;\n   writeln(y.f0 + y.f" << n - 1
+       << " + y.a[1])\nend;\n";
+    ss << "begin\n";
+    for (int i = 0; i < n; i += 16)
+    {
+	ss << "   x.f" << i << " := " << i << ";\n";
+    }
+    ss << "   x.f" << n - 1 << " := 1;\n   x.a[1] := 2;\n   p(x)\nend.\n";
+    WriteFile(base + ".pas", ss.str());
+}
+
+// One case statement with n labels.
+static void GenCase(const std::string& base, int n)
+{
+    std::stringstream ss;
+    ss << "program cases;\nvar\n   i, total : integer;\nbegin\n   total := 0;\n   for i := 0 to " << n - 1
+       << " do\n      case i of\n";
+    for (int i = 0; i < n; i++)
+    {
+	ss << "\t" << i << " : total := total + " << (i % 7) << ";\n";
+    }
+    ss << "      end;\n   writeln(total)\nend.\n";
+    WriteFile(base + ".pas", ss.str());
+}
+
+// A program using n units.
+static void GenUnits(const std::string& base, int n)
+{
+    std::string dir = base.substr(0, base.find_last_of('/') + 1);
+    std::string prefix = base.substr(base.find_last_of('/') + 1) + "_u";
+    for (int i = 0; i < n; i++)
+    {
+	std::stringstream ss;
+	ss << "unit " << prefix << i << ";\ninterface\nfunction f" << i
+	   << "(x : integer) : integer;\nimplementation\nfunction f" << i
+	   << "(x : integer) : integer;\nbegin\n   f" << i << " := x + " << i << "\nend;\nend.\n";
+	WriteFile(dir + prefix + std::to_string(i) + ".pas", ss.str());
+    }
+    std::stringstream ss;
+    ss << "program units;\n";
+    for (int i = 0; i < n; i++)
+    {
+	ss << "uses " << prefix << i << ";\n";
+    }
+    ss << "begin\n   writeln(0";
+    for (int i = 0; i < n; i++)
+    {
+	ss << " + f" << i << "(1)";
+    }
+    ss << ")\nend.\n";
+    WriteFile(base + ".pas", ss.str());
+}
+
+// An expression nested n deep.
+static void GenExpr(const std::string& base, int n)
+{
+    std::stringstream ss;
+    ss << "program expr;\nvar\n   a, x : integer;\nbegin\n   a := 1;\n   x := ";
+    for (int i = 0; i < n; i++)
+    {
+	ss << "(";
+    }
+    ss << "a";
+    for (int i = 0; i < n; i++)
+    {
+	ss << (i % 2 ? " - " : " + ") << "a * " << i % 5 << ")";
+    }
+    ss << ";\n   writeln(x)\nend.\n";
+    WriteFile(base + ".pas", ss.str());
+}
+
+// Compile, and pick up the "Time for <phase> <t> ms" and "Peak RSS <n> KB" lines from -tt.
+static bool Compile(const std::string& source, const std::string& opt, Result& result)
+{
+    std::string cmd = compiler + " -tt " + opt + " " + source + " 2>&1";
+    FILE*       f = popen(cmd.c_str(), "r");
+    if (!f)
+    {
+	return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f))
+    {
+	char   name[256];
+	double t;
+	long   rss;
+	if (sscanf(line, " Time for %255s %lf ms", name, &t) == 2)
+	{
+	    // Phases that happen more than once (e.g. parsing units) are added up.
+	    result.phases[name] += t;
+	}
+	else if (sscanf(line, "Peak RSS %ld KB", &rss) == 1)
+	{
+	    result.peakRss = rss;
+	}
+    }
+    return pclose(f) == 0;
+}
+
+static void WriteJson(std::ostream& out, const std::vector<Result>& results,
+                      const std::vector<std::string>& flags)
+{
+    out << "{\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+	const Result& r = results[i];
+	out << "    { \"dimension\": \"" << r.dimension << "\", \"size\": " << r.size << ", \"opt\": \""
+	    << r.opt << "\", \"peak_rss_kb\": " << r.peakRss << ", \"phases\": {";
+	bool first = true;
+	for (auto p : r.phases)
+	{
+	    out << (first ? " " : ", ") << "\"" << p.first << "\": " << std::fixed << std::setprecision(3)
+	        << p.second;
+	    first = false;
+	}
+	out << " } }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"superlinear\": [\n";
+    for (size_t i = 0; i < flags.size(); i++)
+    {
+	out << "    " << flags[i] << (i + 1 < flags.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Compare each size with the previous one of the same dimension and optimisation level.
+static std::vector<std::string> CheckGrowth(const std::vector<Result>& results)
+{
+    std::vector<std::string> flags;
+    for (size_t i = 1; i < results.size(); i++)
+    {
+	const Result& prev = results[i - 1];
+	const Result& cur = results[i];
+	if (prev.dimension != cur.dimension || prev.opt != cur.opt)
+	{
+	    continue;
+	}
+	double sizeRatio = static_cast<double>(cur.size) / prev.size;
+	for (auto p : cur.phases)
+	{
+	    auto   it = prev.phases.find(p.first);
+	    double prevTime = (it != prev.phases.end()) ? it->second : 0;
+	    if (p.second < minCheckTime || prevTime <= 0)
+	    {
+		continue;
+	    }
+	    double timeRatio = p.second / prevTime;
+	    if (timeRatio > sizeRatio * growthMargin)
+	    {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2) << "{ \"dimension\": \"" << cur.dimension
+		   << "\", \"opt\": \"" << cur.opt << "\", \"phase\": \"" << p.first
+		   << "\", \"from\": " << prev.size << ", \"to\": " << cur.size
+		   << ", \"size_ratio\": " << sizeRatio << ", \"time_ratio\": " << timeRatio << " }";
+		flags.push_back(ss.str());
+		std::cerr << "Super-linear: " << cur.dimension << " " << cur.opt << " " << p.first << " "
+		          << prev.size << " -> " << cur.size << ": time x" << std::setprecision(2)
+		          << timeRatio << " for size x" << sizeRatio << std::endl;
+	    }
+	}
+    }
+    return flags;
+}
+
+int main(int argc, char** argv)
+{
+    std::string outName = "scalebench.json";
+    if (argc > 1)
+    {
+	outName = argv[1];
+    }
+
+    std::vector<Dimension> dimensions = {
+	{ "procedures", { 250, 500, 1000, 2000 }, GenProcs },
+	{ "nesting", { 8, 16, 32, 64 }, GenNesting },
+	{ "record", { 1000, 2000, 4000, 8000 }, GenRecord },
+	{ "case", { 250, 500, 1000, 2000 }, GenCase },
+	{ "units", { 5, 10, 20, 40 }, GenUnits },
+	{ "expression", { 100, 200, 400, 800 }, GenExpr },
+    };
+    std::vector<std::string> opts = { "-O0", "-O1", "-O2", "-O3" };
+
+    mkdir(workDir.c_str(), 0755);
+    std::vector<Result> results;
+    bool                failed = false;
+    for (auto& d : dimensions)
+    {
+	for (auto opt : opts)
+	{
+	    for (auto size : d.sizes)
+	    {
+		std::string base = workDir + "/" + d.name + std::to_string(size);
+		d.generate(base, size);
+		Result r = { d.name, size, opt, {}, 0 };
+		if (!Compile(base + ".pas", opt, r))
+		{
+		    std::cerr << "Failed to compile " << base << ".pas " << opt << std::endl;
+		    failed = true;
+		}
+		std::cout << std::left << std::setw(12) << d.name << std::right << std::setw(6) << size << " "
+		          << opt << " " << std::fixed << std::setprecision(3) << std::setw(10)
+		          << r.phases["Compile"] << " ms " << std::setw(8) << r.peakRss << " KB" << std::endl;
+		results.push_back(r);
+	    }
+	}
+    }
+
+    std::vector<std::string> flags = CheckGrowth(results);
+    std::ofstream            out(outName);
+    WriteJson(out, results, flags);
+    std::system(("rm -rf " + workDir).c_str());
+
+    return (failed || !flags.empty()) ? 1 : 0;
+}
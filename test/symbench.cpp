@@ -0,0 +1,194 @@
+// Symbol table lookup throughput.
+//
+// Models the name lookups made while parsing a program with 10000 global identifiers and 1000
+// procedures, each with its own locals, and times them with the compiler's scoped symbol table
+// (names interned once, as the lexer does) and with the std::map per scope that it replaced.
+// Built by "make symbench" in the top directory, as it uses the compiler's own headers.
+
+#include "../stack.h"
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+int  verbosity;
+bool caseInsensitive = true;
+
+const int numGlobals = 10000;
+const int numProcs = 1000;
+const int numLocals = 10;
+const int lookupsPerProc = 200;
+const int repeats = 20;
+
+struct Symbol
+{
+    void dump() const {}
+};
+
+// The previous symbol table: one map per scope, searched from the innermost scope outwards, with
+// the name lowercased on every lookup.
+class MapStack
+{
+public:
+    MapStack() { NewLevel(); }
+    void NewLevel() { stack.push_back({}); }
+    void DropLevel() { stack.pop_back(); }
+    bool Add(std::string name, const Symbol* v)
+    {
+	strlower(name);
+	return stack.back().insert({ name, v }).second;
+    }
+    const Symbol* Find(std::string name) const
+    {
+	strlower(name);
+	for (auto s = stack.rbegin(); s != stack.rend(); s++)
+	{
+	    if (auto it = s->find(name); it != s->end())
+	    {
+		return it->second;
+	    }
+	}
+	return 0;
+    }
+
+private:
+    std::deque<std::map<std::string, const Symbol*>> stack;
+};
+
+struct Program
+{
+    std::vector<std::string>              globals;
+    std::vector<std::vector<std::string>> locals;
+    // Names used in the body of each procedure, in source order.
+    std::vector<std::vector<std::string>> uses;
+};
+
+static Program MakeProgram()
+{
+    Program  p;
+    unsigned seed = 12345;
+    auto     next = [&]()
+    {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+    };
+    for (int i = 0; i < numGlobals; i++)
+    {
+	p.globals.push_back("Global_" + std::to_string(i));
+    }
+    for (int i = 0; i < numProcs; i++)
+    {
+	std::vector<std::string> locals;
+	for (int j = 0; j < numLocals; j++)
+	{
+	    locals.push_back("Local_" + std::to_string(j));
+	}
+	std::vector<std::string> uses;
+	for (int j = 0; j < lookupsPerProc; j++)
+	{
+	    // Mostly locals, as in real code, with a mix of case as Pascal allows.
+	    if (next() % 4)
+	    {
+		uses.push_back("LOCAL_" + std::to_string(next() % numLocals));
+	    }
+	    else
+	    {
+		uses.push_back("global_" + std::to_string(next() % numGlobals));
+	    }
+	}
+	p.locals.push_back(locals);
+	p.uses.push_back(uses);
+    }
+    return p;
+}
+
+static double RunMap(const Program& p, const Symbol* sym, size_t& found)
+{
+    auto     start = std::chrono::steady_clock::now();
+    MapStack stack;
+    for (auto& g : p.globals)
+    {
+	stack.Add(g, sym);
+    }
+    for (int r = 0; r < repeats; r++)
+    {
+	for (int i = 0; i < numProcs; i++)
+	{
+	    stack.NewLevel();
+	    for (auto& l : p.locals[i])
+	    {
+		stack.Add(l, sym);
+	    }
+	    for (auto& u : p.uses[i])
+	    {
+		found += stack.Find(u) != 0;
+	    }
+	    stack.DropLevel();
+	}
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double RunHashed(const Program& p, const Symbol* sym, size_t& found)
+{
+    // The lexer interns each identifier as it reads it, which is not part of the lookup.
+    std::vector<std::vector<Ident>> uses;
+    for (auto& u : p.uses)
+    {
+	std::vector<Ident> idents;
+	for (auto& n : u)
+	{
+	    idents.push_back(Intern(n));
+	}
+	uses.push_back(idents);
+    }
+
+    auto                 start = std::chrono::steady_clock::now();
+    Stack<const Symbol*> stack;
+    for (auto& g : p.globals)
+    {
+	stack.Add(g, sym);
+    }
+    for (int r = 0; r < repeats; r++)
+    {
+	for (int i = 0; i < numProcs; i++)
+	{
+	    stack.NewLevel();
+	    for (auto& l : p.locals[i])
+	    {
+		stack.Add(l, sym);
+	    }
+	    for (auto u : uses[i])
+	    {
+		found += stack.Find(u) != 0;
+	    }
+	    stack.DropLevel();
+	}
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    Program p = MakeProgram();
+    Symbol  sym;
+    size_t  mapFound = 0;
+    size_t  hashFound = 0;
+    double  mapTime = RunMap(p, &sym, mapFound);
+    double  hashTime = RunHashed(p, &sym, hashFound);
+    if (mapFound != hashFound)
+    {
+	std::cerr << "Lookups differ: " << mapFound << " vs " << hashFound << std::endl;
+	return 1;
+    }
+
+    double lookups = static_cast<double>(repeats) * numProcs * lookupsPerProc;
+    std::cout << std::fixed << std::setprecision(2) << "map per scope: " << std::setw(8)
+              << lookups / mapTime / 1e6 << " M lookups/s\n"
+              << "hashed:        " << std::setw(8) << lookups / hashTime / 1e6 << " M lookups/s\n"
+              << "speedup:       " << std::setw(8) << mapTime / hashTime << "x" << std::endl;
+    return 0;
+}
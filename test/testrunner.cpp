@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -198,6 +199,374 @@ bool TimeTestCase::Result()
     return true;
 }
 
+/* Class that compiles and runs the program in-process, using the JIT */
+class JitTestCase : public TestCase
+{
+public:
+    JitTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual bool Compile(const std::string& options);
+    virtual bool Run();
+
+private:
+    std::string compileOptions;
+};
+
+JitTestCase::JitTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, arg)
+{
+}
+
+bool JitTestCase::Compile(const std::string& options)
+{
+    // Compilation happens as part of running. The JIT only runs code for the host, so the
+    // 32-bit model is tested as the default model.
+    std::stringstream ss(options);
+    std::string       opt;
+    compileOptions.clear();
+    while (ss >> opt)
+    {
+	if (opt != "-m32")
+	{
+	    compileOptions += " " + opt;
+	}
+    }
+    return true;
+}
+
+bool JitTestCase::Run()
+{
+    std::string resname = replace_ext(source, ".pas", ".res");
+    if (RunCmd("cd " + Dir() + "; ../" + compiler + " " + compileOptions + " --run " + source + " " + args +
+               " > " + resname))
+    {
+	return false;
+    }
+    return true;
+}
+
+/* Class that compiles the unit separately, then uses it from the program */
+class UnitTestCase : public TestCase
+{
+public:
+    UnitTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual void Clean();
+    virtual bool Compile(const std::string& options);
+
+private:
+    void        RemoveUnitFiles();
+    std::string unit;
+};
+
+UnitTestCase::UnitTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, ""), unit(arg)
+{
+}
+
+void UnitTestCase::RemoveUnitFiles()
+{
+    std::string ifacename = Dir() + "/" + replace_ext(unit, ".pas", ".pi");
+    remove(ifacename.c_str());
+    std::string objname = Dir() + "/" + replace_ext(unit, ".pas", ".o");
+    remove(objname.c_str());
+}
+
+void UnitTestCase::Clean()
+{
+    TestCase::Clean();
+    RemoveUnitFiles();
+}
+
+bool UnitTestCase::Compile(const std::string& options)
+{
+    bool res = RunCmd(compiler + " " + options + " -unit " + Dir() + "/" + unit) == 0 &&
+               TestCase::Compile(options);
+    // Other tests compile the unit from source, so don't leave the interface file around.
+    RemoveUnitFiles();
+    return res;
+}
+
+/* Class that compiles twice with a cache directory, where the second compile should hit the cache */
+class CacheTestCase : public TestCase
+{
+public:
+    CacheTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual void Clean();
+    virtual bool Compile(const std::string& options);
+
+private:
+    std::string CacheDir() { return Dir() + "/cache"; }
+};
+
+CacheTestCase::CacheTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, arg)
+{
+}
+
+void CacheTestCase::Clean()
+{
+    TestCase::Clean();
+    RunCmd("rm -rf " + CacheDir());
+}
+
+bool CacheTestCase::Compile(const std::string& options)
+{
+    std::string cacheOptions = options + " -cache-dir=" + CacheDir();
+    std::string exename = Dir() + "/" + replace_ext(source, ".pas", "");
+    if (!TestCase::Compile(cacheOptions))
+    {
+	return false;
+    }
+    remove(exename.c_str());
+    // The statistics follow the source, so the command is built here rather than by TestCase.
+    return RunCmd(compiler + " " + cacheOptions + " -cache-stats " + Dir() + "/" + source +
+                  " 2>&1 | grep -q 'Hits: *1$'") == 0;
+}
+
+/* Class that compiles with the runtime bitcode linked into the program */
+class RuntimeBcTestCase : public TestCase
+{
+public:
+    RuntimeBcTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual bool Compile(const std::string& options);
+};
+
+RuntimeBcTestCase::RuntimeBcTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, arg)
+{
+}
+
+bool RuntimeBcTestCase::Compile(const std::string& options)
+{
+    // The bitcode is only built for the 64-bit model.
+    if (options.find("-m32") != std::string::npos)
+    {
+	return TestCase::Compile(options);
+    }
+    return TestCase::Compile(options + " -runtime-bc");
+}
+
+/* Class that compiles with code generation split over several threads */
+/* Class that builds the program with -j 1 and with -j 4, which must give the same object files, as
+ * the partitions only depend on the program. The program built with -j 4 is then run as usual. */
+class ParallelTestCase : public TestCase
+{
+public:
+    ParallelTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual void Clean();
+    virtual bool Compile(const std::string& options);
+
+private:
+    std::string ObjName(size_t n)
+    {
+	return Dir() + "/" + replace_ext(source, ".pas", n ? "." + std::to_string(n) + ".o" : ".o");
+    }
+};
+
+ParallelTestCase::ParallelTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, arg)
+{
+}
+
+void ParallelTestCase::Clean()
+{
+    TestCase::Clean();
+    for (size_t n = 0; std::ifstream(ObjName(n)) || std::ifstream(ObjName(n) + ".j1"); n++)
+    {
+	remove(ObjName(n).c_str());
+	remove((ObjName(n) + ".j1").c_str());
+    }
+}
+
+bool ParallelTestCase::Compile(const std::string& options)
+{
+    if (!TestCase::Compile(options + " -j 1 -keep-obj"))
+    {
+	return false;
+    }
+    size_t objects = 0;
+    while (std::ifstream(ObjName(objects)))
+    {
+	std::string obj = ObjName(objects++);
+	if (rename(obj.c_str(), (obj + ".j1").c_str()))
+	{
+	    return false;
+	}
+    }
+    if (!objects || !TestCase::Compile(options + " -j 4 -keep-obj"))
+    {
+	return false;
+    }
+    bool same = true;
+    for (size_t n = 0; n < objects; n++)
+    {
+	same &= RunCmd("cmp " + ObjName(n) + ".j1 " + ObjName(n)) == 0;
+    }
+    if (std::ifstream(ObjName(objects)))
+    {
+	std::cout << "More objects with -j 4 than with -j 1" << std::endl;
+	same = false;
+    }
+    return same;
+}
+
+/* Class that checks the optimised LLVM IR. Each line of the template is "function callee", and there
+ * must be a direct call to callee in the entry block of function, e.g. hoisted out of a loop. */
+class IrTestCase : public TestCase
+{
+public:
+    IrTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual void        Clean();
+    virtual bool        Compile(const std::string& options);
+    virtual bool        Run();
+    virtual bool        Result();
+    virtual std::string Dir() { return "Ir"; }
+
+private:
+    bool        InEntryBlock(const std::string& function, const std::string& callee);
+    std::string IrName() { return Dir() + "/" + replace_ext(source, ".pas", ".ll"); }
+};
+
+IrTestCase::IrTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, arg)
+{
+}
+
+void IrTestCase::Clean()
+{
+    TestCase::Clean();
+    remove(IrName().c_str());
+}
+
+bool IrTestCase::Compile(const std::string& options)
+{
+    // Always -O2, whatever level the other tests use.
+    std::stringstream ss(options);
+    std::string       opt;
+    std::string       irOptions;
+    while (ss >> opt)
+    {
+	if (opt.compare(0, 2, "-O") != 0)
+	{
+	    irOptions += " " + opt;
+	}
+    }
+    return TestCase::Compile(irOptions + " -O2 -emit=llvm");
+}
+
+bool IrTestCase::Run()
+{
+    // Nothing to run.
+    return true;
+}
+
+bool IrTestCase::InEntryBlock(const std::string& function, const std::string& callee)
+{
+    std::ifstream ir(IrName());
+    std::string   line;
+    bool          inFunction = false;
+    while (getline(ir, line))
+    {
+	if (!inFunction)
+	{
+	    inFunction = line.compare(0, 7, "define ") == 0 &&
+	                 line.find("." + function + "(") != std::string::npos;
+	    continue;
+	}
+	// The entry block ends at the next label, or with the function.
+	if (line == "entry:")
+	{
+	    continue;
+	}
+	if (!line.empty() && line[0] != ' ')
+	{
+	    return false;
+	}
+	// Names with characters such as '$' are quoted in the IR.
+	if (line.find("call ") != std::string::npos &&
+	    (line.find("@" + callee + "(") != std::string::npos ||
+	     line.find("@\"" + callee + "\"(") != std::string::npos))
+	{
+	    return true;
+	}
+    }
+    return false;
+}
+
+bool IrTestCase::Result()
+{
+    std::ifstream tp("expected/" + Dir() + "/" + replace_ext(source, ".pas", ".tpl"));
+    std::string   function;
+    std::string   callee;
+    bool          result = true;
+    while (tp >> function >> callee)
+    {
+	if (!InEntryBlock(function, callee))
+	{
+	    std::cout << "No call to " << callee << " at the start of " << function << std::endl;
+	    result = false;
+	}
+    }
+    return result;
+}
+
+/* Class that goes through the profile generate, run and use cycle, and reports the speedup */
+class PgoTestCase : public TestCase
+{
+public:
+    PgoTestCase(const std::string& nm, const std::string& src, const std::string& arg);
+    virtual void Clean();
+    virtual bool Compile(const std::string& options);
+    virtual bool Run();
+
+private:
+    bool        TimedRun(double& elapsed);
+    std::string ProfileName(const std::string& ext) { return Dir() + "/" + replace_ext(source, ".pas", ext); }
+    double      baseTime;
+};
+
+PgoTestCase::PgoTestCase(const std::string& nm, const std::string& src, const std::string& arg)
+    : TestCase(nm, src, arg), baseTime(0)
+{
+}
+
+void PgoTestCase::Clean()
+{
+    TestCase::Clean();
+    remove(ProfileName(".profraw").c_str());
+    remove(ProfileName(".profdata").c_str());
+}
+
+bool PgoTestCase::TimedRun(double& elapsed)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool res = TestCase::Run();
+    auto end = std::chrono::steady_clock::now();
+    elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+    return res;
+}
+
+bool PgoTestCase::Compile(const std::string& options)
+{
+    const char* env = getenv("LLVM_PROFDATA");
+    std::string profdata = env ? env : "llvm-profdata";
+    return TestCase::Compile(options) && TimedRun(baseTime) &&
+           TestCase::Compile(options + " -fprofile-generate") && TestCase::Run() &&
+           RunCmd(profdata + " merge -o " + ProfileName(".profdata") + " " + ProfileName(".profraw")) == 0 &&
+           TestCase::Compile(options + " -fprofile-use=" + ProfileName(".profdata"));
+}
+
+bool PgoTestCase::Run()
+{
+    double pgoTime;
+    if (!TimedRun(pgoTime))
+    {
+	return false;
+    }
+    std::cout << name << ": " << std::setprecision(3) << std::fixed << baseTime << " ms without profile, "
+              << pgoTime << " ms with profile, speedup " << baseTime / pgoTime << std::endl;
+    return true;
+}
+
 // Class to test compile detection of errors.
 class CompileTimeError : public TestCase
 {
@@ -247,6 +616,41 @@ TestCase* TestCaseFactory(const std::string& type, const std::string& name, cons
 	return new TimeTestCase(name, source, args);
     }
 
+    if (type == "Jit")
+    {
+	return new JitTestCase(name, source, args);
+    }
+
+    if (type == "Unit")
+    {
+	return new UnitTestCase(name, source, args);
+    }
+
+    if (type == "Cache")
+    {
+	return new CacheTestCase(name, source, args);
+    }
+
+    if (type == "RuntimeBc")
+    {
+	return new RuntimeBcTestCase(name, source, args);
+    }
+
+    if (type == "Parallel")
+    {
+	return new ParallelTestCase(name, source, args);
+    }
+
+    if (type == "Ir")
+    {
+	return new IrTestCase(name, source, args);
+    }
+
+    if (type == "Pgo")
+    {
+	return new PgoTestCase(name, source, args);
+    }
+
     if (type == "CompErr")
     {
 	return new CompileTimeError(name, source, args);
@@ -350,6 +754,7 @@ TestEntry testCaseList[] = {
     { 0, "Basic", "Fact Bignum", "fact-bignum.pas", "" },
     { 0, "Basic", "Nested Funcs", "nestfunc.pas", "" },
     { 0, "Basic", "Nested Funcs2", "nestfunc2.pas", "" },
+    { 0, "Basic", "Nested Funcs3", "nestfunc3.pas", "" },
     { 0, "Basic", "Recursion", "recursion.pas", " < recursion.txt" },
     { 0, "Basic", "Test 04", "test04.pas", "" },
     { 0, "Basic", "Test 07", "test07.pas", "" },
@@ -379,6 +784,17 @@ TestEntry testCaseList[] = {
     { 0, "Basic", "Set Values 2", "set2.pas", "" },
     { 0, "Basic", "Set Values 3", "set3.pas", "" },
     { 0, "Basic", "Set Values 4", "set4.pas", "" },
+    { 0, "Basic", "Big Set as booleans", "bigbool.pas", " < bigbool.txt" },
+    // Free Pascal only supports sets of up to 256 elements.
+    { LACSAP_ONLY, "Basic", "Big Set", "bigset.pas", " < bigset.txt" },
+    // Free Pascal doesn't support the >< operator.
+    { LACSAP_ONLY, "Basic", "Set Operations", "setops.pas", " < setops.txt" },
+    // Free Pascal doesn't support card.
+    { LACSAP_ONLY, "Basic", "Set Literals", "setlit.pas", "" },
+    { 0, "Basic", "Tokens", "tokens.pas", " < tokens.txt" },
+    // Free Pascal doesn't support index.
+    { LACSAP_ONLY, "Basic", "Long Strings", "longstr.pas", " < longstr.txt" },
+    { LACSAP_ONLY, "Basic", "String Append", "strappend.pas", " < strappend.txt" },
     // Free Pascal doesn't support popcount!
     { LACSAP_ONLY, "Basic", "Pop Count", "popcnt.pas", "" },
     { 0, "Basic", "Sudoku", "sudoku.pas", "" },
@@ -409,6 +825,8 @@ TestEntry testCaseList[] = {
     { LACSAP_ONLY, "Basic", "Function arg5", "func5.pas", "" },
     { LACSAP_ONLY, "Basic", "Function arg6", "func6.pas", "" },
     { LACSAP_ONLY, "Basic", "Function arg7", "func7.pas", "" },
+    { LACSAP_ONLY, "Basic", "Function arg8", "func8.pas", "" },
+    { LACSAP_ONLY, "Basic", "Function arg9", "func9.pas", "" },
     { 0, "Basic", "Multiple decl", "multidecl.pas", "" },
     { 0, "Basic", "Numeric", "numeric.pas", "" },
     { 0, "Basic", "Goto", "goto.pas", "" },
@@ -423,6 +841,7 @@ TestEntry testCaseList[] = {
     { 0, "Basic", "Double Begin", "doublebegin.pas", "" },
     { 0, "Basic", "Simple unit", "unit_main.pas", "" },
     { 0, "Basic", "Simple unit2", "unit_main2.pas", "" },
+    { 0, "Basic", "Several units", "unit_multi.pas", "" },
     { LACSAP_ONLY, "Basic", "Pack & Unpack", "packunpack.pas", "" },
     { 0, "Basic", "With statement", "with.pas", "" },
     { LACSAP_ONLY, "Basic", "ISO 7185 PAT", "iso7185pat.pas", "" },
@@ -431,6 +850,7 @@ TestEntry testCaseList[] = {
     { 0, "Basic", "Read char array", "readchars.pas", "< readchars.txt" },
     { 0, "Basic", "Game of life", "gol.pas", "< gol.txt" },
     { 0, "Basic", "Inline", "inline.pas", "" },
+    { LACSAP_ONLY, "Basic", "Inline directives", "inline2.pas", "" },
     { 0, "Basic", "Val", "val.pas", "" },
     { 0, "Basic", "Bool Ops", "boolops.pas", "" },
     { 0, "Basic", "Exponentiation", "pow.pas", "" },
@@ -480,10 +900,43 @@ TestEntry testCaseList[] = {
     { LACSAP_ONLY, "File", "CopyFile2", "copyfile2.pas", "File/infile.dat File/outfile.dat" },
     { 0, "File", "File", "file.pas", "File/test1.txt expected/File/test1.txt" },
 
+    // Run in-process with the JIT, using the same expected results as the normal build.
+    { LACSAP_ONLY, "Jit", "JIT TestSet", "testset.pas", "" },
+    { LACSAP_ONLY, "Jit", "JIT Simple unit", "unit_main.pas", "" },
+    { LACSAP_ONLY, "Jit", "JIT Virtuals", "virt.pas", "" },
+    { LACSAP_ONLY, "Jit", "JIT param", "param.pas", "1 fun \"quoted string\"" },
+    { LACSAP_ONLY, "Jit", "JIT course", "course.pas", "< course.in" },
+
+    // Unit compiled separately, with interface file.
+    { LACSAP_ONLY, "Unit", "Separate unit", "unit_main.pas", "unit_file.pas" },
+    { LACSAP_ONLY, "Unit", "Separate unit2", "unit_main2.pas", "unit_file2.pas" },
+
+    // Second compile links the object from the cache.
+    { LACSAP_ONLY, "Cache", "Cached TestSet", "testset.pas", "" },
+    { LACSAP_ONLY, "Cache", "Cached unit", "unit_main.pas", "" },
+
+    // Runtime optimised along with the program.
+    { LACSAP_ONLY, "RuntimeBc", "Runtime bitcode Set", "set_test.pas", "" },
+    { LACSAP_ONLY, "RuntimeBc", "Runtime bitcode String compare", "strcomp.pas", "" },
+    { LACSAP_ONLY, "RuntimeBc", "Runtime bitcode File", "course.pas", "< course.in" },
+
+    // Code generation split into partitions.
+    { LACSAP_ONLY, "Parallel", "Parallel codegen ISO 7185 PAT", "iso7185pat.pas", "" },
+    { LACSAP_ONLY, "Parallel", "Parallel codegen Dhrystone", "dhry.pas", "< dhry.in" },
+
+    // Optimised IR, checking that runtime calls are moved out of loops.
+    { LACSAP_ONLY, "Ir", "Hoist string and set compares", "hoist.pas", "" },
+    { LACSAP_ONLY, "Ir", "Devirtualise virtual calls", "devirt.pas", "" },
+    { LACSAP_ONLY, "Ir", "Flatten keeps noinline calls", "flatten.pas", "" },
+
     // Check that compiler doesn't get too slow.
     { 0, "Time", "LongCompile", "longcompile.pas", "1000" },
 };
 
+// Run with -P, as this needs llvm-profdata.
+TestEntry pgoCaseList[] = { { 0, "Pgo", "Dhrystone", "dhry.pas", "< dhry.in" },
+                            { 0, "Pgo", "Whetstone", "whet.pas", "" } };
+
 // Keep "negative" tests in a separate category
 TestEntry negativeCaseList[] = { { 0, "CompErr", "Goto err", "goto.pas", "" },
                                  { 0, "CompErr", "Goto err2", "goto2.pas", "" },
@@ -515,6 +968,7 @@ TestEntry negativeCaseList[] = { { 0, "CompErr", "Goto err", "goto.pas", "" },
                                  { 0, "CompErr", "Not Char", "notchar.pas", "" },
                                  { 0, "CompErr", "Not Real", "notreal.pas", "" },
                                  { 0, "CompErr", "Bad negate", "badneg.pas", "" },
+                                 { 0, "CompErr", "Bad hex literal", "badhex.pas", "" },
                                  { 0, "CompErr", "chr of char", "chrchar.pas", "" },
                                  { 0, "CompErr", "Odd of char", "oddchar.pas", "" },
                                  { 0, "CompErr", "Bad if-stmt", "badif.pas", "" },
@@ -575,6 +1029,7 @@ int main(int argc, char** argv)
     std::vector<std::string> others = { "", "-Cr", "-g" };
     int                      flags = 0;
     int                      negative = false;
+    int                      pgo = false;
 
     for (int i = 1; i < argc; i++)
     {
@@ -588,13 +1043,25 @@ int main(int argc, char** argv)
 	{
 	    negative = true;
 	}
+	else if (std::string(argv[i]) == "-P")
+	{
+	    pgo = true;
+	    mode = "-O2";
+	}
 	else
 	{
 	    mode = argv[i];
 	}
     }
 
-    if (mode == "full" || !negative)
+    if (pgo)
+    {
+	for (auto t : pgoCaseList)
+	{
+	    tc.push_back(TestCaseFactory(t.type, t.name, t.source, t.args));
+	}
+    }
+    else if (mode == "full" || !negative)
     {
 	for (auto t : testCaseList)
 	{
@@ -605,7 +1072,7 @@ int main(int argc, char** argv)
 	}
     }
 
-    if (mode == "full" || negative)
+    if (!pgo && (mode == "full" || negative))
     {
 	for (auto t : negativeCaseList)
 	{
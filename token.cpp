@@ -3,8 +3,10 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <string_view>
+#include <unordered_map>
 
-Token::Token(TokenType t, const Location& w) : type(t), where(w)
+Token::Token(TokenType t, const Location& w) : type(t), where(w), ident(0)
 {
     if (where)
     {
@@ -13,18 +15,19 @@ Token::Token(TokenType t, const Location& w) : type(t), where(w)
     }
 }
 
-Token::Token(TokenType t, const Location& w, const std::string& str) : type(t), where(w), strVal(str)
+Token::Token(TokenType t, const Location& w, const std::string& str)
+    : type(t), where(w), strVal(str), ident(t == Token::Identifier ? Intern(str) : 0)
 {
     ICE_IF(t != Token::Identifier && t != Token::StringLiteral, "Invalid token for string argument");
     ICE_IF(t == Token::Identifier && str.empty(), "String should not be empty for identifier");
 }
 
-Token::Token(TokenType t, const Location& w, uint64_t v) : type(t), where(w), intVal(v)
+Token::Token(TokenType t, const Location& w, uint64_t v) : type(t), where(w), ident(0), intVal(v)
 {
     ICE_IF(t != Token::Integer && t != Token::Char, "Invalid token construction");
 }
 
-Token::Token(const Location& w, double v) : type(Token::Real), where(w), realVal(v) {}
+Token::Token(const Location& w, double v) : type(Token::Real), where(w), ident(0), realVal(v) {}
 
 std::string Token::ToString() const
 {
@@ -202,23 +205,6 @@ static const TokenEntry* FindToken(Token::TokenType type)
     ICE("Could not find token!");
 }
 
-static const TokenEntry* FindToken(std::string kw)
-{
-    /* Don't "tolower" the keyword if it starts with __ */
-    if (kw.substr(0, 2) != "__")
-    {
-	strlower(kw);
-    }
-    for (auto& i : tokenTable)
-    {
-	if (kw == i.str)
-	{
-	    return &i;
-	}
-    }
-    return 0;
-}
-
 std::string Token::TypeStr() const
 {
     const TokenEntry* t = FindToken(type);
@@ -233,10 +219,35 @@ int Token::Precedence() const
 
 Token::TokenType Token::KeyWordToToken(const std::string& str)
 {
-    const TokenEntry* t = FindToken(str);
-    if (t && t->isKeyWord)
+    // Every identifier goes through here, so the keywords are hashed rather than searched for.
+    static const std::unordered_map<std::string_view, Token::TokenType> keyWords = []()
+    {
+	std::unordered_map<std::string_view, Token::TokenType> m;
+	for (auto& i : tokenTable)
+	{
+	    if (i.isKeyWord)
+	    {
+		m[i.str] = i.type;
+	    }
+	}
+	return m;
+    }();
+
+    // No keyword is anywhere near this long.
+    char kw[32];
+    if (str.size() > sizeof(kw))
+    {
+	return Token::Unknown;
+    }
+    /* Don't "tolower" the keyword if it starts with __ */
+    bool lower = str.compare(0, 2, "__") != 0;
+    for (size_t i = 0; i < str.size(); i++)
+    {
+	kw[i] = lower ? std::tolower(static_cast<unsigned char>(str[i])) : str[i];
+    }
+    if (auto it = keyWords.find(std::string_view(kw, str.size())); it != keyWords.end())
     {
-	return t->type;
+	return it->second;
     }
     return Token::Unknown;
 }
@@ -1,6 +1,7 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include "ident.h"
 #include "location.h"
 #include "utils.h"
 
@@ -152,6 +153,12 @@ public:
 	ICE_IF(strVal.empty(), "String should not be empty!");
 	return strVal;
     }
+    // The name as interned by the lexer, for looking it up.
+    Ident GetIdent() const
+    {
+	ICE_IF(type != Token::Identifier, "Incorrect type for ident");
+	return ident;
+    }
 
     uint64_t GetIntVal() const
     {
@@ -191,6 +198,7 @@ private:
 
     // Values.
     std::string strVal;
+    Ident       ident;
     uint64_t    intVal;
     double      realVal;
 };
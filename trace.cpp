@@ -2,28 +2,54 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Scopes shorter than this (in microseconds) are left out of the trace file.
+static const unsigned traceGranularity = 50;
+
+// Nesting level of the scopes, used to indent the -tt output. Units are parsed on their own threads.
+static thread_local int depth;
 
 class TimeTraceImpl
 {
 public:
-    TimeTraceImpl(const char* func) : func(func) { start = std::chrono::steady_clock::now(); }
+    TimeTraceImpl(const char* func, const std::string& detail) : func(func), hasDetail(!detail.empty())
+    {
+	if (llvm::timeTraceProfilerEnabled())
+	{
+	    llvm::timeTraceProfilerBegin(func, detail);
+	}
+	depth++;
+	start = std::chrono::steady_clock::now();
+    }
 
     ~TimeTraceImpl()
     {
 	end = std::chrono::steady_clock::now();
-	uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-	std::cerr << "Time for " << func << " " << std::fixed << std::setprecision(3) << elapsed / 1000.0
-	          << " ms" << std::endl;
+	depth--;
+	if (timetrace && !hasDetail)
+	{
+	    uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	    std::cerr << std::string(depth * 2, ' ') << "Time for " << func << " " << std::fixed
+	              << std::setprecision(3) << elapsed / 1000.0 << " ms" << std::endl;
+	}
+	if (llvm::timeTraceProfilerEnabled())
+	{
+	    llvm::timeTraceProfilerEnd();
+	}
     }
 
 private:
     std::chrono::time_point<std::chrono::steady_clock> start, end;
     const char*                                        func;
+    bool                                               hasDetail;
 };
 
-void TimeTrace::createImpl(const char* func)
+void TimeTrace::createImpl(const char* func, const std::string& detail)
 {
-    impl = new TimeTraceImpl(func);
+    impl = new TimeTraceImpl(func, detail);
 }
 
 void TimeTrace::destroyImpl()
@@ -31,6 +57,53 @@ void TimeTrace::destroyImpl()
     delete impl;
 }
 
+static std::string traceProgName;
+
+void TimeTraceInit(const char* progName)
+{
+    if (!traceFile.empty())
+    {
+	traceProgName = progName;
+	llvm::timeTraceProfilerInitialize(traceGranularity, progName);
+    }
+}
+
+// A worker that runs on the main thread itself finds the profiler already there.
+TimeTraceThread::TimeTraceThread() : active(!traceFile.empty() && !llvm::timeTraceProfilerEnabled())
+{
+    if (active)
+    {
+	llvm::timeTraceProfilerInitialize(traceGranularity, traceProgName);
+    }
+}
+
+TimeTraceThread::~TimeTraceThread()
+{
+    if (active)
+    {
+	llvm::timeTraceProfilerFinishThread();
+    }
+}
+
+bool TimeTraceWrite()
+{
+    if (!llvm::timeTraceProfilerEnabled())
+    {
+	return true;
+    }
+    std::error_code      ec;
+    llvm::raw_fd_ostream out(traceFile, ec, llvm::sys::fs::OF_Text);
+    if (ec)
+    {
+	std::cerr << "Could not open " << traceFile << ": " << ec.message() << std::endl;
+	llvm::timeTraceProfilerCleanup();
+	return false;
+    }
+    llvm::timeTraceProfilerWrite(out);
+    llvm::timeTraceProfilerCleanup();
+    return true;
+}
+
 void trace(const char* file, int line, const char* func)
 {
     std::cerr << file << ":" << line << "::" << func << std::endl;
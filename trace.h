@@ -2,17 +2,19 @@
 #define TRACE_H
 
 #include "options.h"
+#include <string>
 
 class TimeTraceImpl;
 
 class TimeTrace
 {
 public:
-    TimeTrace(const char* func) : impl(0)
+    // Scopes with a detail (e.g. the name of the Pascal function) only go in the trace file.
+    TimeTrace(const char* func, const std::string& detail = std::string()) : impl(0)
     {
-	if (timetrace)
+	if (timetrace || !traceFile.empty())
 	{
-	    createImpl(func);
+	    createImpl(func, detail);
 	}
     }
     ~TimeTrace()
@@ -22,11 +24,29 @@ public:
     }
 
 private:
-    void           createImpl(const char* func);
+    void           createImpl(const char* func, const std::string& detail);
     void           destroyImpl();
     TimeTraceImpl* impl;
 };
 
+// Start and write the trace-event file given with -trace-file. LLVM's own time trace, such as
+// the time for each pass, is recorded in the same file.
+void TimeTraceInit(const char* progName);
+bool TimeTraceWrite();
+
+// The trace file profiler is per thread. Threads other than the main one create one of these
+// first, and their events are added to the main thread's trace when it goes away. The thread
+// must end before TimeTraceWrite is called.
+class TimeTraceThread
+{
+public:
+    TimeTraceThread();
+    ~TimeTraceThread();
+
+private:
+    bool active;
+};
+
 void trace(const char* file, int line, const char* func);
 
 #define TRACE()                                                                                              \
@@ -37,5 +57,6 @@ void trace(const char* file, int line, const char* func);
     } while (0)
 
 #define TIME_TRACE() TimeTrace timeTraceInstance(__FUNCTION__);
+#define TIME_TRACE_SCOPE(name, detail) TimeTrace timeTraceInstance(name, detail);
 
 #endif
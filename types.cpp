@@ -5,6 +5,7 @@
 #include "trace.h"
 #include <climits>
 #include <llvm/IR/LLVMContext.h>
+#include <mutex>
 #include <sstream>
 
 extern llvm::Module* theModule;
@@ -13,16 +14,31 @@ namespace Types
 {
     static std::vector<std::pair<TypeDecl*, llvm::TrackingMDRef>> fwdMap;
 
+    // Units are parsed on several threads, and the parser needs LLVM types for sizeof. Types are
+    // created in the shared context, and the DataLayout caches struct layouts, so only one thread
+    // at a time may do either.
+    static std::recursive_mutex llvmTypeMutex;
+
+    size_t AllocSizeOf(llvm::Type* ty)
+    {
+	std::lock_guard<std::recursive_mutex> lock(llvmTypeMutex);
+	return theModule->getDataLayout().getTypeAllocSize(ty);
+    }
+
+    size_t PrefAlignOf(llvm::Type* ty)
+    {
+	std::lock_guard<std::recursive_mutex> lock(llvmTypeMutex);
+	return theModule->getDataLayout().getPrefTypeAlign(ty).value();
+    }
+
     size_t TypeDecl::Size() const
     {
-	const llvm::DataLayout& dl = theModule->getDataLayout();
-	return dl.getTypeAllocSize(LlvmType());
+	return AllocSizeOf(LlvmType());
     }
 
     size_t TypeDecl::AlignSize() const
     {
-	const llvm::DataLayout& dl = theModule->getDataLayout();
-	return dl.getPrefTypeAlign(LlvmType()).value();
+	return PrefAlignOf(LlvmType());
     }
 
     Range* TypeDecl::GetRange() const
@@ -56,11 +72,18 @@ namespace Types
 
     llvm::Type* TypeDecl::LlvmType() const
     {
-	if (!lType)
+	llvm::Type* ty = lType.load(std::memory_order_acquire);
+	if (!ty)
 	{
-	    lType = GetLlvmType();
+	    std::lock_guard<std::recursive_mutex> lock(llvmTypeMutex);
+	    ty = lType.load(std::memory_order_relaxed);
+	    if (!ty)
+	    {
+		ty = GetLlvmType();
+		lType.store(ty, std::memory_order_release);
+	    }
 	}
-	return lType;
+	return ty;
     }
 
     llvm::DIType* TypeDecl::DebugType(llvm::DIBuilder* builder) const
@@ -516,7 +539,6 @@ namespace Types
 	std::cerr << "[" << lowName << ".." << highName << "]";
     }
 
-    int  EnumDecl::staticID = 0;
     void EnumDecl::SetValues(const std::vector<std::string>& nmv)
     {
 	unsigned int v = 0;
@@ -598,13 +620,12 @@ namespace Types
 
     llvm::Type* VariantDecl::GetLlvmType() const
     {
-	const llvm::DataLayout& dl = theModule->getDataLayout();
-	size_t                 maxSize = 0;
-	size_t                 maxSizeElt = 0;
-	size_t                 maxAlign = 0;
-	size_t                 maxAlignElt = 0;
-	size_t                 maxAlignSize = 0;
-	size_t                 elt = 0;
+	size_t maxSize = 0;
+	size_t maxSizeElt = 0;
+	size_t maxAlign = 0;
+	size_t maxAlignElt = 0;
+	size_t maxAlignSize = 0;
+	size_t elt = 0;
 	for (auto f : fields)
 	{
 	    llvm::Type* ty = f->LlvmType();
@@ -619,8 +640,8 @@ namespace Types
 		    return opaqueType;
 		}
 	    }
-	    size_t sz = dl.getTypeAllocSize(ty);
-	    size_t al = dl.getPrefTypeAlign(ty).value();
+	    size_t sz = AllocSizeOf(ty);
+	    size_t al = PrefAlignOf(ty);
 	    if (sz > maxSize)
 	    {
 		maxSize = sz;
@@ -787,11 +808,11 @@ namespace Types
 	int            index = 0;
 
 	llvm::StructType*         st = llvm::cast<llvm::StructType>(LlvmType());
-	const llvm::DataLayout&   dl = theModule->getDataLayout();
 	const llvm::StructLayout* sl = 0;
 	if (!st->isOpaque())
 	{
-	    sl = dl.getStructLayout(st);
+	    std::lock_guard<std::recursive_mutex> lock(llvmTypeMutex);
+	    sl = theModule->getDataLayout().getStructLayout(st);
 	}
 
 	// TODO: Need to deal with recursive types here...
@@ -879,6 +900,10 @@ namespace Types
 	{
 	    membfuncs = baseobj->membfuncs;
 	}
+	for (ClassDecl* b = baseobj; b; b = b->baseobj)
+	{
+	    b->derived.push_back(this);
+	}
 
 	std::vector<VarDef> self = { VarDef("self", this, VarDef::Flags::Reference) };
 	for (auto i : mf)
@@ -1004,7 +1029,7 @@ namespace Types
 
 	    if (opacity == FilledIn && (m->IsOverride() || m->IsVirtual()))
 	    {
-		FuncPtrDecl* fp = new FuncPtrDecl(m->Proto());
+		FuncPtrDecl* fp = new FuncPtrDecl(m->Proto(), FuncPtrDecl::Plain);
 		vt.push_back(fp->LlvmType());
 	    }
 	}
@@ -1160,17 +1185,12 @@ namespace Types
 
     llvm::Type* FuncPtrDecl::GetLlvmType() const
     {
-	std::vector<llvm::Type*> argTys;
-	for (auto v : proto->Args())
+	llvm::Type* ptrTy = llvm::PointerType::getUnqual(theContext);
+	if (kind == Plain)
 	{
-	    llvm::Type* ty = v.Type()->LlvmType();
-	    if (v.IsRef() || IsCompound(v.Type()))
-	    {
-		ty = llvm::PointerType::getUnqual(theContext);
-	    }
-	    argTys.push_back(ty);
+	    return ptrTy;
 	}
-	return llvm::PointerType::getUnqual(theContext);
+	return llvm::StructType::get(theContext, { ptrTy, ptrTy });
     }
 
     llvm::DIType* FuncPtrDecl::GetDIType(llvm::DIBuilder* builder) const
@@ -1325,7 +1345,7 @@ namespace Types
 
     const TypeDecl* StringDecl::CompatibleType(const TypeDecl* ty) const
     {
-	if (SameAs(ty) || ty->Type() == TK_Char)
+	if (SameAs(ty) || ty->Type() == TK_Char || ty->Type() == TK_LongString)
 	{
 	    return this;
 	}
@@ -1350,6 +1370,31 @@ namespace Types
 	return 0;
     }
 
+    void LongStringDecl::DoDump() const
+    {
+	std::cerr << "LongString";
+    }
+
+    const TypeDecl* LongStringDecl::CompatibleType(const TypeDecl* ty) const
+    {
+	if (SameAs(ty) || IsStringLike(ty))
+	{
+	    return this;
+	}
+	return 0;
+    }
+
+    llvm::Type* LongStringDecl::GetLlvmType() const
+    {
+	return llvm::PointerType::getUnqual(theContext);
+    }
+
+    llvm::DIType* LongStringDecl::GetDIType(llvm::DIBuilder* builder) const
+    {
+	llvm::DIType* charType = Get<CharDecl>()->DebugType(builder);
+	return builder->createPointerType(charType, Size() * CHAR_BIT, AlignSize() * CHAR_BIT);
+    }
+
     // Void pointer is not a "pointer to void", but a "pointer to Int8".
     llvm::Type* GetVoidPtrType()
     {
@@ -1452,7 +1497,7 @@ namespace Types
 	case TypeDecl::TK_Variant:
 	case TypeDecl::TK_Record:
 	case TypeDecl::TK_Class:
-	    return t->lType;
+	    return t->lType.load(std::memory_order_acquire);
 
 	case TypeDecl::TK_String:
 	case TypeDecl::TK_FuncPtr:
@@ -1489,8 +1534,7 @@ namespace Types
 
     TypeDecl* GetTimeStampType()
     {
-	static TypeDecl* timeStampType;
-	if (!timeStampType)
+	static TypeDecl* timeStampType = []()
 	{
 	    // DateValid, TimeValid, Year, Month, Day, Hour, Minute, Second
 	    std::vector<FieldDecl*> fields = {
@@ -1504,33 +1548,31 @@ namespace Types
 		new FieldDecl("Second", MakeRange(0, 61), false),
 		new FieldDecl("MicroSecond", MakeRange(0, 999999), false),
 	    };
-	    timeStampType = new RecordDecl(fields, nullptr);
-	    ICE_IF(sizeof(TimeStamp) != timeStampType->Size(),
-	           "Runtime and Pascal TimeStamp type should match in size");
-	}
+	    TypeDecl* ty = new RecordDecl(fields, nullptr);
+	    ICE_IF(sizeof(TimeStamp) != ty->Size(), "Runtime and Pascal TimeStamp type should match in size");
+	    return ty;
+	}();
 	return timeStampType;
     }
 
     TypeDecl* GetBindingType()
     {
-	static TypeDecl* bindingType;
-	if (!bindingType)
+	static TypeDecl* bindingType = []()
 	{
 	    std::vector<FieldDecl*> fields = {
 		new FieldDecl("Bound", Get<BoolDecl>(), false),
 		new FieldDecl("Name", Get<StringDecl>(255), false),
 	    };
-	    bindingType = new RecordDecl(fields, nullptr);
-	    ICE_IF(sizeof(BindingType) != bindingType->Size(),
-	           "Runtime and Pascal Binding type should match in size");
-	}
+	    TypeDecl* ty = new RecordDecl(fields, nullptr);
+	    ICE_IF(sizeof(BindingType) != ty->Size(), "Runtime and Pascal Binding type should match in size");
+	    return ty;
+	}();
 	return bindingType;
     }
 
     TypeDecl* GetEnumToStrType()
     {
-	static TypeDecl* enum2strType;
-	if (!enum2strType)
+	static TypeDecl* enum2strType = []()
 	{
 	    const auto r = std::vector<RangeBaseDecl*>(1, new RangeDecl(new Range(1, 1), Get<IntegerDecl>()));
 
@@ -1539,10 +1581,10 @@ namespace Types
 		new FieldDecl("nelem", Get<IntegerDecl>(), false),
 		new FieldDecl("offset", new ArrayDecl(Get<IntegerDecl>(), r), false)
 	    };
-	    enum2strType = new RecordDecl(fields, nullptr);
-	    ICE_IF(sizeof(EnumToString) != enum2strType->Size(),
-	           "Runtime and EnumToString type should match in size");
-	}
+	    TypeDecl* ty = new RecordDecl(fields, nullptr);
+	    ICE_IF(sizeof(EnumToString) != ty->Size(), "Runtime and EnumToString type should match in size");
+	    return ty;
+	}();
 	return enum2strType;
     }
 
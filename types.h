@@ -1,6 +1,8 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include "arena.h"
+#include <atomic>
 #include <iostream>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/DIBuilder.h>
@@ -27,11 +29,8 @@ namespace Types
     template<typename T, typename... Args>
     TypeDecl* Get(Args... args)
     {
-	static TypeDecl* typePtr;
-	if (!typePtr)
-	{
-	    typePtr = new T(std::forward<Args>(args)...);
-	}
+	// Initialised once, even when units are parsed on several threads.
+	static TypeDecl* typePtr = new T(std::forward<Args>(args)...);
 	return typePtr;
     }
 
@@ -48,6 +47,10 @@ namespace Types
     bool IsCompound(const TypeDecl* t);
     bool HasLlvmType(const TypeDecl* t);
 
+    // The DataLayout caches struct layouts, so all queries go through these, under the type lock.
+    size_t AllocSizeOf(llvm::Type* ty);
+    size_t PrefAlignOf(llvm::Type* ty);
+
     // Range is either created by the user, or calculated on basetype
     class Range
     {
@@ -104,12 +107,19 @@ namespace Types
 	    TK_MemberFunc,
 	    TK_Forward,
 	    TK_Complex,
+	    TK_LongString,
 	};
 
 	TypeDecl(TypeKind k) : kind(k), lType(0), diType(0), name(""), init(0) {}
 
 	virtual TypeKind Type() const { return kind; }
 	virtual ~TypeDecl() {}
+	// Types live in the arena of the compilation, and are never deleted one by one.
+	static void*            operator new(size_t size)
+	{
+	    return Arena::Allocate(size, Arena::Type, Arena::Destroy<TypeDecl>);
+	}
+	static void             operator delete(void*) {}
 	virtual Range*          GetRange() const;
 	virtual bool            SameAs(const TypeDecl* ty) const { return kind == ty->Type(); }
 	virtual const TypeDecl* CompatibleType(const TypeDecl* ty) const;
@@ -139,11 +149,11 @@ namespace Types
 	virtual llvm::DIType* GetDIType(llvm::DIBuilder* builder) const = 0;
 
     protected:
-	const TypeKind        kind;
-	mutable llvm::Type*   lType;
-	mutable llvm::DIType* diType;
-	std::string           name;
-	ExprAST*              init;
+	const TypeKind                   kind;
+	mutable std::atomic<llvm::Type*> lType;
+	mutable llvm::DIType*            diType;
+	std::string                      name;
+	ExprAST*                         init;
     };
 
     class ForwardDecl : public TypeDecl
@@ -366,20 +376,13 @@ namespace Types
 	};
 
 	using EnumValues = std::vector<EnumValue>;
-	static int staticID;
 	EnumDecl(TypeKind tk, const std::vector<std::string>& nmv, TypeDecl* ty) : CompoundDecl(tk, ty)
 	{
 	    ICE_IF(nmv.empty(), "Must have names in the enum type.");
 	    SetValues(nmv);
 	}
-	EnumDecl(const std::vector<std::string>& nmv, TypeDecl* ty) : EnumDecl(TK_Enum, nmv, ty)
-	{
-	    uniqueID = staticID++;
-	}
-	EnumDecl(TypeKind tk, const EnumValues& vals, TypeDecl* ty) : CompoundDecl(tk, ty), values(vals)
-	{
-	    uniqueID = staticID++;
-	}
+	EnumDecl(const std::vector<std::string>& nmv, TypeDecl* ty) : EnumDecl(TK_Enum, nmv, ty) {}
+	EnumDecl(TypeKind tk, const EnumValues& vals, TypeDecl* ty) : CompoundDecl(tk, ty), values(vals) {}
 
     private:
 	void SetValues(const std::vector<std::string>& nmv);
@@ -391,14 +394,12 @@ namespace Types
 	static bool       classof(const TypeDecl* e) { return e->getKind() == TK_Enum; }
 	bool              SameAs(const TypeDecl* ty) const override;
 	TypeDecl*         Clone() const override { return new EnumDecl(kind, values, SubType()); }
-	int               UniqueId() { return uniqueID; }
 
     protected:
 	llvm::DIType* GetDIType(llvm::DIBuilder* builder) const override;
 
     private:
 	EnumValues values;
-	int        uniqueID;
     };
 
     class BoolDecl : public EnumDecl
@@ -626,6 +627,8 @@ namespace Types
 	llvm::Type*      VTableType(Opacity opaque) const;
 	static bool      classof(const TypeDecl* e) { return e->getKind() == TK_Class; }
 	const TypeDecl*  DerivedFrom(const TypeDecl* ty) const;
+	// Classes derived from this one, directly or not, as declared in the program.
+	const std::vector<ClassDecl*>& Derived() const { return derived; }
 
     protected:
 	llvm::Type*   GetLlvmType() const override;
@@ -635,15 +638,39 @@ namespace Types
 	ClassDecl*                   baseobj;
 	VariantDecl*                 variant;
 	std::vector<MemberFuncDecl*> membfuncs;
+	std::vector<ClassDecl*>      derived;
 	mutable llvm::StructType*    vtableType;
     };
 
+    /*
+     * Procedure types and procedural parameters are a closure:
+     * struct
+     * {
+     *    void *code;  // Called with env as the first argument.
+     *    void *env;
+     * }
+     * Member functions in a vtable are plain pointers.
+     */
     class FuncPtrDecl : public CompoundDecl
     {
     public:
-	FuncPtrDecl(const PrototypeAST* func) : CompoundDecl(TK_FuncPtr, 0), proto(func) {}
+	enum Kind
+	{
+	    Closure,
+	    Plain,
+	};
+	enum
+	{
+	    Code,
+	    Env,
+	};
+	FuncPtrDecl(const PrototypeAST* func, Kind k = Closure)
+	    : CompoundDecl(TK_FuncPtr, 0), proto(func), kind(k)
+	{
+	}
 	void                DoDump() const override;
 	const PrototypeAST* Proto() const { return proto; }
+	bool                IsClosure() const { return kind == Closure; }
 	bool                SameAs(const TypeDecl* ty) const override;
 	static bool         classof(const TypeDecl* e) { return e->getKind() == TK_FuncPtr; }
 
@@ -653,6 +680,7 @@ namespace Types
 
     private:
 	const PrototypeAST* proto;
+	Kind                kind;
     };
 
     class FileDecl : public CompoundDecl
@@ -690,11 +718,15 @@ namespace Types
 	// Must match with "runtime".
 	enum
 	{
-	    MaxSetWords = 16,
+	    MaxSetWords = 2048,
 	    SetBits = 32,
 	    MaxSetSize = MaxSetWords * SetBits,
 	    SetMask = SetBits - 1,
-	    SetPow2Bits = 5
+	    SetPow2Bits = 5,
+	    // Size used for "set of integer" and other sets of types too large to have a set of.
+	    DefaultSetSize = 512,
+	    // Larger sets are handled by loops in the runtime rather than inline code.
+	    MaxInlineWords = 16
 	};
 	SetDecl(RangeBaseDecl* r, TypeDecl* ty) : SetDecl(TK_Set, r, ty) {}
 	SetDecl(TypeKind k, RangeBaseDecl* r, TypeDecl* ty);
@@ -729,6 +761,22 @@ namespace Types
 	int             Capacity() const { return Ranges()[0]->GetRange()->Size() - 2; }
     };
 
+    // A string of any length. The value is a pointer to a reference counted block on the heap, which
+    // is shared by assignment and copied when changed while shared, or null for the empty string.
+    class LongStringDecl : public TypeDecl
+    {
+    public:
+	LongStringDecl() : TypeDecl(TK_LongString) {}
+	const TypeDecl* CompatibleType(const TypeDecl* ty) const override;
+	void            DoDump() const override;
+	static bool     classof(const TypeDecl* e) { return e->getKind() == TK_LongString; }
+	TypeDecl*       Clone() const override { return new LongStringDecl(); }
+
+    protected:
+	llvm::Type*   GetLlvmType() const override;
+	llvm::DIType* GetDIType(llvm::DIBuilder* builder) const override;
+    };
+
     class ComplexDecl : public RecordDecl
     {
     public:
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include <climits>
 #include <iostream>
+#include <llvm/Support/FileSystem.h>
 
 std::string GetPath(const std::string& filename)
 {
@@ -10,6 +11,17 @@ std::string GetPath(const std::string& filename)
     return compiler.substr(0, pos);
 }
 
+bool IsUpToDate(const std::string& target, const std::string& source)
+{
+    llvm::sys::fs::file_status ts;
+    llvm::sys::fs::file_status ss;
+    if (llvm::sys::fs::status(target, ts) || llvm::sys::fs::status(source, ss))
+    {
+	return false;
+    }
+    return ts.getLastModificationTime() >= ss.getLastModificationTime();
+}
+
 // TODO: Do we want a source location too?
 void InternalCompilerError(const char* file, int line, const std::string& msg)
 {
@@ -10,6 +10,8 @@ inline void strlower(std::string& str)
 }
 
 std::string GetPath(const std::string& fileName);
+// True if target exists and is at least as new as source.
+bool IsUpToDate(const std::string& target, const std::string& source);
 
 [[noreturn]] void InternalCompilerError(const char* file, int line, const std::string& msg);
 [[noreturn]] void InternalCompilerError(const char* file, int line, const std::string& condStr,